@@ -0,0 +1,319 @@
+#include "apply-journal.hpp"
+#include "file-ops.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "logger/log.h"
+
+static const char journal_magic[8] = {'S', 'L', 'U', 'P', 'J', 'R', 'N', 'L'};
+static const uint32_t journal_version = 1;
+
+/* Records are written out when this much is buffered, one flush to disk per phase */
+static constexpr size_t journal_buffer_size = 1024 * 1024;
+
+static uint32_t record_checksum(const journal_record_t &record, const char *paths)
+{
+	/* FNV-1a over record fields and paths, enough to tell a torn write */
+	uint32_t hash = 2166136261u;
+	auto add = [&hash](const void *data, size_t length) {
+		const unsigned char *bytes = static_cast<const unsigned char *>(data);
+		for (size_t i = 0; i < length; i++) {
+			hash ^= bytes[i];
+			hash *= 16777619u;
+		}
+	};
+
+	add(&record.op, sizeof(record.op));
+	add(&record.from_length, sizeof(record.from_length));
+	add(&record.to_length, sizeof(record.to_length));
+	add(paths, static_cast<size_t>(record.from_length) + record.to_length);
+	return hash;
+}
+
+apply_journal::~apply_journal()
+{
+	if (m_file)
+		fclose(m_file);
+}
+
+bool apply_journal::open(const fs::path &journal_file)
+{
+	m_path = journal_file;
+	m_finished = false;
+
+#ifdef _WIN32
+	m_file = _wfopen(journal_file.c_str(), L"wb");
+#else
+	m_file = fopen(journal_file.c_str(), "wb");
+#endif
+	if (!m_file) {
+		log_warn("Failed to create update journal, update goes on without it");
+		return false;
+	}
+
+	journal_header_t header;
+	memcpy(header.magic, journal_magic, sizeof(journal_magic));
+	header.version = journal_version;
+	header.reserved = 0;
+
+	const char *bytes = reinterpret_cast<const char *>(&header);
+	m_buffer.assign(bytes, bytes + sizeof(header));
+	return sync();
+}
+
+void apply_journal::append(journal_op op, const std::string &from, const std::string &to)
+{
+	journal_record_t record;
+	record.op = static_cast<uint32_t>(op);
+	record.from_length = static_cast<uint32_t>(from.size());
+	record.to_length = static_cast<uint32_t>(to.size());
+
+	std::string paths = from + to;
+	record.checksum = record_checksum(record, paths.data());
+
+	const char *bytes = reinterpret_cast<const char *>(&record);
+	m_buffer.insert(m_buffer.end(), bytes, bytes + sizeof(record));
+	m_buffer.insert(m_buffer.end(), paths.begin(), paths.end());
+}
+
+void apply_journal::add_move(journal_op op, const fs::path &from, const fs::path &to)
+{
+	if (!m_file)
+		return;
+
+	append(op, from.u8string(), to.u8string());
+
+	if (m_buffer.size() >= journal_buffer_size)
+		write_buffer();
+}
+
+bool apply_journal::write_buffer()
+{
+	if (m_buffer.empty())
+		return true;
+
+	bool written = fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) == m_buffer.size();
+	m_buffer.clear();
+
+	if (!written)
+		log_warn("Failed to write update journal");
+	return written;
+}
+
+bool apply_journal::sync()
+{
+	if (!m_file)
+		return false;
+
+	bool synced = write_buffer() && fflush(m_file) == 0;
+#ifdef _WIN32
+	synced = synced && _commit(_fileno(m_file)) == 0;
+#else
+	synced = synced && fsync(fileno(m_file)) == 0;
+#endif
+
+	if (!synced)
+		log_warn("Failed to flush update journal to disk");
+	return synced;
+}
+
+bool apply_journal::mark(journal_op op)
+{
+	if (!m_file)
+		return false;
+
+	append(op, std::string(), std::string());
+	if (op == journal_op::finished)
+		m_finished = true;
+
+	return sync();
+}
+
+void apply_journal::remove()
+{
+	if (m_file) {
+		fclose(m_file);
+		m_file = nullptr;
+	}
+
+	std::error_code ec;
+	fs::remove(m_path, ec);
+}
+
+namespace {
+struct journal_move_t {
+	journal_op op;
+	fs::path from;
+	fs::path to;
+};
+}
+
+static bool recover_move(const fs::path &from, const fs::path &to)
+{
+	std::error_code ec;
+	fs::create_directories(to.parent_path(), ec);
+	move_file(from, to, ec);
+	if (ec) {
+		log_error("Recovery failed to move %s to %s, error %s", from.u8string().c_str(), to.u8string().c_str(), ec.message().c_str());
+		return false;
+	}
+	return true;
+}
+
+bool apply_journal::recover(const fs::path &journal_file)
+{
+	std::error_code ec;
+	if (!fs::exists(journal_file, ec))
+		return true;
+
+	std::ifstream input(journal_file, std::ios::binary);
+	std::vector<char> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+	input.close();
+
+	journal_header_t header;
+	if (data.size() < sizeof(header)) {
+		fs::remove(journal_file, ec);
+		return true;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+	if (memcmp(header.magic, journal_magic, sizeof(journal_magic)) != 0 || header.version != journal_version) {
+		log_warn("Update journal has unknown format, ignoring it");
+		fs::remove(journal_file, ec);
+		return true;
+	}
+
+	std::vector<journal_move_t> backups;
+	std::vector<journal_move_t> applies;
+	bool applied = false;
+	bool finished = false;
+
+	size_t offset = sizeof(header);
+	while (data.size() - offset >= sizeof(journal_record_t)) {
+		journal_record_t record;
+		memcpy(&record, data.data() + offset, sizeof(record));
+		offset += sizeof(record);
+
+		const uint64_t paths_length = static_cast<uint64_t>(record.from_length) + record.to_length;
+		if (paths_length > data.size() - offset || record_checksum(record, data.data() + offset) != record.checksum)
+			break;
+
+		const char *from = data.data() + offset;
+		const char *to = from + record.from_length;
+		offset += static_cast<size_t>(paths_length);
+
+		switch (static_cast<journal_op>(record.op)) {
+		case journal_op::backup:
+			backups.push_back({journal_op::backup, fs::u8path(from, from + record.from_length), fs::u8path(to, to + record.to_length)});
+			break;
+		case journal_op::apply:
+			applies.push_back({journal_op::apply, fs::u8path(from, from + record.from_length), fs::u8path(to, to + record.to_length)});
+			break;
+		case journal_op::applied:
+			applied = true;
+			break;
+		case journal_op::finished:
+			finished = true;
+			break;
+		}
+	}
+
+	if (finished || (backups.empty() && applies.empty())) {
+		fs::remove(journal_file, ec);
+		return true;
+	}
+
+	auto start_time = std::chrono::steady_clock::now();
+
+	/* Apply phase is journaled only after all backups are done. It can be finished
+	 * if every new file not moved in place yet is still staged */
+	bool roll_forward = applied;
+	if (!roll_forward && !applies.empty()) {
+		roll_forward = true;
+		for (const journal_move_t &move : applies) {
+			if (!fs::exists(move.from, ec) && !fs::exists(move.to, ec)) {
+				roll_forward = false;
+				break;
+			}
+		}
+	}
+
+	size_t moved = 0;
+	bool failed = false;
+
+	if (roll_forward) {
+		/* Backups are done before apply is journaled, only a directory switch can stop between them */
+		for (const journal_move_t &move : backups) {
+			if (!fs::exists(move.from, ec) || fs::exists(move.to, ec))
+				continue;
+
+			if (recover_move(move.from, move.to)) {
+				moved++;
+			} else {
+				failed = true;
+			}
+		}
+
+		/* Same order as update, version file is last */
+		for (const journal_move_t &move : applies) {
+			if (!fs::exists(move.from, ec))
+				continue;
+
+			if (recover_move(move.from, move.to)) {
+				moved++;
+			} else {
+				failed = true;
+			}
+		}
+	} else {
+		std::unordered_set<fs::path::string_type> backed_up;
+		for (const journal_move_t &move : backups) {
+			backed_up.insert(move.from.native());
+		}
+
+		/* New files already in place go away, changed ones are replaced by their backup below */
+		for (auto it = applies.rbegin(); it != applies.rend(); ++it) {
+			if (fs::exists(it->from, ec) || !fs::exists(it->to, ec) || backed_up.count(it->to.native()) > 0)
+				continue;
+
+			fs::remove(it->to, ec);
+			if (ec) {
+				log_error("Recovery failed to remove %s, error %s", it->to.u8string().c_str(), ec.message().c_str());
+				failed = true;
+			} else {
+				moved++;
+			}
+		}
+
+		for (auto it = backups.rbegin(); it != backups.rend(); ++it) {
+			if (!fs::exists(it->to, ec))
+				continue;
+
+			if (recover_move(it->to, it->from)) {
+				moved++;
+			} else {
+				failed = true;
+			}
+		}
+	}
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+	log_info("Interrupted update rolled %s, journal moves %zu, files touched %zu, %lld ms", roll_forward ? "forward" : "back",
+		 backups.size() + applies.size(), moved, static_cast<long long>(elapsed.count()));
+
+	if (failed) {
+		log_warn("Interrupted update recovery not complete, journal is kept");
+		return false;
+	}
+
+	fs::remove(journal_file, ec);
+	return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/* Write ahead journal of backup and apply phases.
+ *
+ * File layout, all fields little endian:
+ *   journal_header_t
+ *   journal_record_t, each followed by from and to paths in utf8
+ *
+ * Moves of a phase are written and flushed to disk before any of them is done,
+ * so after a crash the journal lists every file which may have moved.
+ * Checksum tells a record torn by the crash, reading stops at it. */
+
+enum class journal_op : uint32_t {
+	// file moved from app dir to backup dir
+	backup = 1,
+	// file moved from new files dir to app dir
+	apply = 2,
+	// all apply moves are done
+	applied = 3,
+	// update verified or reverted, nothing to recover
+	finished = 4
+};
+
+struct journal_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+};
+
+struct journal_record_t {
+	uint32_t op;
+	uint32_t from_length;
+	uint32_t to_length;
+	uint32_t checksum;
+};
+
+static_assert(sizeof(journal_header_t) == 16, "journal header layout changed");
+static_assert(sizeof(journal_record_t) == 16, "journal record layout changed");
+
+class apply_journal {
+public:
+	apply_journal() = default;
+	~apply_journal();
+	apply_journal(const apply_journal &) = delete;
+	apply_journal &operator=(const apply_journal &) = delete;
+
+	// starts new journal, previous one have to be recovered before
+	bool open(const fs::path &journal_file);
+	bool is_open() const { return m_file != nullptr; }
+	bool is_finished() const { return m_finished; }
+
+	// buffered, written out in batches, on disk only after sync
+	void add_move(journal_op op, const fs::path &from, const fs::path &to);
+	bool sync();
+	// marker record, synced at once
+	bool mark(journal_op op);
+	// closes and deletes journal of finished update
+	void remove();
+
+	/* Rolls interrupted update forward if every file not applied yet is still staged, back otherwise.
+	 * Only files listed in journal are touched. Journal is deleted once all its moves are done,
+	 * return false if some move failed and journal is kept to try again */
+	static bool recover(const fs::path &journal_file);
+
+private:
+	void append(journal_op op, const std::string &from, const std::string &to);
+	bool write_buffer();
+
+	fs::path m_path;
+	FILE *m_file{nullptr};
+	std::vector<char> m_buffer;
+	bool m_finished{false};
+};
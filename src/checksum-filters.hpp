@@ -2,12 +2,18 @@
 
 #include <boost/iostreams/constants.hpp>
 #include <boost/iostreams/categories.hpp>
-#include <openssl/sha.h>
+#include <boost/iostreams/read.hpp>
+#include <boost/iostreams/write.hpp>
+
+#include "sha256.hpp"
+#include "tree-hash.hpp"
 
 class sha256_filter {
 public:
-	SHA256_CTX hasher;
-	unsigned char digest[SHA256_DIGEST_LENGTH]{};
+	hash_kind kind;
+	sha256_hasher hasher;
+	tree_hasher tree;
+	digest_t digest;
 	typedef char char_type;
 
 	struct category : boost::iostreams::output,
@@ -18,11 +24,11 @@ public:
 	};
 
 	/* FIXME TODO Signal that errors happened somehow */
-	sha256_filter() { SHA256_Init(&hasher); }
+	explicit sha256_filter(hash_kind kind = hash_kind::sha256) : kind(kind) {}
 
 	template<typename Sink> std::streamsize write(Sink &dest, const char *s, std::streamsize n)
 	{
-		SHA256_Update(&hasher, s, n);
+		update(s, n);
 		boost::iostreams::write(dest, s, n);
 		return n;
 	}
@@ -34,9 +40,24 @@ public:
 		if (result == -1)
 			return result;
 
-		SHA256_Update(&hasher, s, result);
+		update(s, result);
 		return result;
 	}
 
-	template<class Device> void close(Device &device) { SHA256_Final(&digest[0], &hasher); }
+	template<class Device> void close(Device &device)
+	{
+		if (kind == hash_kind::tree_sha256)
+			tree.final(digest.bytes);
+		else
+			hasher.final(digest.bytes);
+	}
+
+private:
+	void update(const char *s, std::streamsize n)
+	{
+		if (kind == hash_kind::tree_sha256)
+			tree.update(s, static_cast<size_t>(n));
+		else
+			hasher.update(s, static_cast<size_t>(n));
+	}
 };
\ No newline at end of file
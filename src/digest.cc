@@ -0,0 +1,110 @@
+#include "digest.hpp"
+
+#ifdef DIGEST_SSE2
+
+/* 16 hex digits to 8 bytes, each byte in the low half of a 16 bit lane */
+static bool parse_hex16(const char *hex, __m128i &pairs)
+{
+	const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hex));
+	const __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+
+	const __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+	const __m128i is_letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+
+	if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xffff)
+		return false;
+
+	const __m128i digit_values = _mm_and_si128(is_digit, _mm_sub_epi8(chars, _mm_set1_epi8('0')));
+	const __m128i letter_values = _mm_and_si128(is_letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10)));
+	const __m128i nibbles = _mm_or_si128(digit_values, letter_values);
+
+	/* Little endian lane has the high nibble digit in its low byte */
+	pairs = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00ff)), 4), _mm_srli_epi16(nibbles, 8));
+	return true;
+}
+
+static __m128i nibbles_to_hex(__m128i nibbles)
+{
+	const __m128i letters_offset = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+	return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters_offset);
+}
+
+bool digest_t::parse_hex(const char *hex, size_t length)
+{
+	if (length != sizeof(bytes) * 2)
+		return false;
+
+	__m128i pairs[4];
+	for (int i = 0; i < 4; i++) {
+		if (!parse_hex16(hex + i * 16, pairs[i]))
+			return false;
+	}
+
+	_mm_store_si128(reinterpret_cast<__m128i *>(bytes), _mm_packus_epi16(pairs[0], pairs[1]));
+	_mm_store_si128(reinterpret_cast<__m128i *>(bytes + 16), _mm_packus_epi16(pairs[2], pairs[3]));
+	return true;
+}
+
+void digest_t::format_hex(char hex[sha256_digest_length * 2]) const
+{
+	const __m128i low_nibble = _mm_set1_epi8(0x0f);
+
+	for (int i = 0; i < 2; i++) {
+		const __m128i value = _mm_load_si128(reinterpret_cast<const __m128i *>(bytes + i * 16));
+		const __m128i high = _mm_and_si128(_mm_srli_epi16(value, 4), low_nibble);
+		const __m128i low = _mm_and_si128(value, low_nibble);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(hex + i * 32), nibbles_to_hex(_mm_unpacklo_epi8(high, low)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(hex + i * 32 + 16), nibbles_to_hex(_mm_unpackhi_epi8(high, low)));
+	}
+}
+
+#else
+
+static int hex_nibble(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+bool digest_t::parse_hex(const char *hex, size_t length)
+{
+	if (length != sizeof(bytes) * 2)
+		return false;
+
+	uint8_t parsed[sizeof(bytes)];
+	for (size_t i = 0; i < sizeof(bytes); i++) {
+		int high = hex_nibble(hex[i * 2]);
+		int low = hex_nibble(hex[i * 2 + 1]);
+		if (high < 0 || low < 0)
+			return false;
+		parsed[i] = static_cast<uint8_t>((high << 4) | low);
+	}
+
+	memcpy(bytes, parsed, sizeof(bytes));
+	return true;
+}
+
+void digest_t::format_hex(char hex[sha256_digest_length * 2]) const
+{
+	static const char hex_digits[] = "0123456789abcdef";
+
+	for (size_t i = 0; i < sizeof(bytes); i++) {
+		hex[i * 2] = hex_digits[bytes[i] >> 4];
+		hex[i * 2 + 1] = hex_digits[bytes[i] & 0x0f];
+	}
+}
+
+#endif
+
+std::string digest_t::to_hex() const
+{
+	std::string hex(sizeof(bytes) * 2, '0');
+	format_hex(&hex[0]);
+	return hex;
+}
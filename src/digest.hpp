@@ -0,0 +1,60 @@
+#pragma once
+
+#include "sha256.hpp"
+
+#include <cstring>
+#include <string>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#define DIGEST_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/* Checksum kept by value instead of a hex string.
+ * All zero bytes mean no checksum, SHA-256 never gives that in practice. */
+struct digest_t {
+	alignas(16) uint8_t bytes[sha256_digest_length]{};
+
+	bool empty() const
+	{
+#ifdef DIGEST_SSE2
+		__m128i any = _mm_or_si128(_mm_load_si128(reinterpret_cast<const __m128i *>(bytes)), _mm_load_si128(reinterpret_cast<const __m128i *>(bytes + 16)));
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) == 0xffff;
+#else
+		static const digest_t zero{};
+		return memcmp(bytes, zero.bytes, sizeof(bytes)) == 0;
+#endif
+	}
+
+	bool operator==(const digest_t &other) const
+	{
+#ifdef DIGEST_SSE2
+		__m128i low = _mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(bytes)), _mm_load_si128(reinterpret_cast<const __m128i *>(other.bytes)));
+		__m128i high = _mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(bytes + 16)),
+					      _mm_load_si128(reinterpret_cast<const __m128i *>(other.bytes + 16)));
+		return _mm_movemask_epi8(_mm_and_si128(low, high)) == 0xffff;
+#else
+		return memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+#endif
+	}
+
+	bool operator!=(const digest_t &other) const { return !(*this == other); }
+
+	// exactly 64 hex digits of any case, digest is left unchanged on failure
+	bool parse_hex(const char *hex, size_t length);
+
+	// 64 lowercase hex digits, no terminator
+	void format_hex(char hex[sha256_digest_length * 2]) const;
+
+	std::string to_hex() const;
+};
+
+/* Digest bytes are uniformly spread already, first word of them is a good enough hash */
+struct digest_hash {
+	size_t operator()(const digest_t &digest) const
+	{
+		size_t hash;
+		memcpy(&hash, digest.bytes, sizeof(hash));
+		return hash;
+	}
+};
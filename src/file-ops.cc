@@ -0,0 +1,301 @@
+#include "file-ops.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+uint64_t get_volume_id(const fs::path &path)
+{
+#ifdef _WIN32
+	uint64_t volume_id = 0;
+
+	/* No access rights requested, directory handles need backup semantics */
+	HANDLE hFile = CreateFileW(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+				   FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (hFile != INVALID_HANDLE_VALUE) {
+		BY_HANDLE_FILE_INFORMATION info;
+		if (GetFileInformationByHandle(hFile, &info)) {
+			/* Serial of zero is valid, keep it apart from failure */
+			volume_id = (1ull << 32) | info.dwVolumeSerialNumber;
+		}
+		CloseHandle(hFile);
+	}
+
+	return volume_id;
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return 0;
+	return static_cast<uint64_t>(info.st_dev) + 1;
+#endif
+}
+
+bool copy_file_offload(const fs::path &from, const fs::path &to, std::error_code &ec)
+{
+	ec.clear();
+
+#ifdef _WIN32
+	if (!CopyFileExW(from.c_str(), to.c_str(), NULL, NULL, NULL, 0)) {
+		ec = std::error_code(GetLastError(), std::system_category());
+		return false;
+	}
+	return true;
+#else
+	int source = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+	if (source < 0) {
+		ec = std::error_code(errno, std::generic_category());
+		return false;
+	}
+
+	int target = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (target < 0) {
+		ec = std::error_code(errno, std::generic_category());
+		close(source);
+		return false;
+	}
+
+	bool in_kernel = true;
+	while (true) {
+		ssize_t copied;
+		if (in_kernel) {
+			copied = copy_file_range(source, nullptr, target, nullptr, 1 << 30, 0);
+			if (copied < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+				/* Older kernels and some file systems copy only within one file system */
+				in_kernel = false;
+				continue;
+			}
+		} else {
+			static thread_local std::vector<char> buffer(1024 * 1024);
+			copied = read(source, buffer.data(), buffer.size());
+			for (ssize_t written = 0; copied > 0 && written < copied;) {
+				ssize_t result = write(target, buffer.data() + written, static_cast<size_t>(copied - written));
+				if (result < 0) {
+					if (errno == EINTR)
+						continue;
+					copied = -1;
+					break;
+				}
+				written += result;
+			}
+		}
+
+		if (copied < 0 && errno == EINTR)
+			continue;
+		if (copied <= 0) {
+			if (copied < 0)
+				ec = std::error_code(errno, std::generic_category());
+			break;
+		}
+	}
+
+	close(source);
+	if (close(target) != 0 && !ec)
+		ec = std::error_code(errno, std::generic_category());
+	return !ec;
+#endif
+}
+
+bool move_file(const fs::path &from, const fs::path &to, std::error_code &ec, bool *copied)
+{
+	if (copied)
+		*copied = false;
+
+	fs::rename(from, to, ec);
+	if (ec != std::errc::cross_device_link)
+		return !ec;
+
+	if (!copy_file_offload(from, to, ec))
+		return false;
+
+	if (copied)
+		*copied = true;
+
+	std::error_code remove_ec;
+	fs::remove(from, remove_ec);
+	return true;
+}
+
+static const char tombstone_marker[] = ".tombstone-";
+
+bool hold_process_lock(const fs::path &lock_file, std::error_code &ec)
+{
+	ec.clear();
+
+	/* Handle is left open on purpose, the system closes it when the process exits however it exits */
+#ifdef _WIN32
+	HANDLE hFile = CreateFileW(lock_file.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		ec = std::error_code(GetLastError(), std::system_category());
+		return false;
+	}
+	return true;
+#else
+	int fd = open(lock_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		ec = std::error_code(errno, std::generic_category());
+		return false;
+	}
+
+	/* Share mode emulated with flock, it is held by the open file and so also keeps out a second open in this process */
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		ec = std::error_code(errno, std::generic_category());
+		close(fd);
+		return false;
+	}
+	return true;
+#endif
+}
+
+static void split_dir(const fs::path &dir, fs::path &parent, fs::path &name)
+{
+	parent = dir.has_filename() ? dir.parent_path() : dir.parent_path().parent_path();
+	name = dir.has_filename() ? dir.filename() : dir.parent_path().filename();
+}
+
+fs::path rename_to_tombstone(const fs::path &dir, std::error_code &ec)
+{
+	static std::atomic_uint32_t tombstone_counter{0};
+
+	fs::path parent, name;
+	split_dir(dir, parent, name);
+
+	/* Time and counter keep names of this and earlier runs apart */
+	name += tombstone_marker;
+	name += std::to_string(std::chrono::system_clock::now().time_since_epoch().count()) + "-" + std::to_string(tombstone_counter++);
+
+	fs::path tombstone = parent / name;
+	fs::rename(dir, tombstone, ec);
+	if (ec)
+		return fs::path();
+	return tombstone;
+}
+
+bool is_tombstone_of(const fs::path &path, const fs::path &dir)
+{
+	fs::path parent, name;
+	split_dir(dir, parent, name);
+
+	const fs::path normal = path.lexically_normal();
+	if (normal.parent_path() != (parent / name).lexically_normal().parent_path())
+		return false;
+
+	const std::string prefix = name.u8string() + tombstone_marker;
+	const std::string file_name = normal.filename().u8string();
+	if (file_name.compare(0, prefix.size(), prefix) != 0)
+		return false;
+
+	/* Time and counter as rename_to_tombstone writes them */
+	const std::string suffix = file_name.substr(prefix.size());
+	const size_t dash = suffix.find('-');
+	auto is_number = [](const std::string &text) { return !text.empty() && text.find_first_not_of("0123456789") == std::string::npos; };
+	return dash != std::string::npos && is_number(suffix.substr(0, dash)) && is_number(suffix.substr(dash + 1));
+}
+
+void append_cleanup_list(const fs::path &list_file, const fs::path &dir, const fs::path &tombstone)
+{
+	/* Tab is not valid in a path on Windows */
+	std::ofstream list(list_file, std::ios::binary | std::ios::app);
+	list << dir.u8string() << "\t" << tombstone.u8string() << "\n";
+}
+
+static bool is_known_dir(const fs::path &dir, const std::vector<fs::path> &known_dirs, const fs::path &runs_root)
+{
+	const fs::path normal = dir.lexically_normal();
+	for (const fs::path &known : known_dirs) {
+		const fs::path known_normal = known.lexically_normal();
+		if (normal == known_normal)
+			return true;
+
+		if (!runs_root.empty() && normal.filename() == known_normal.filename() && known_normal.parent_path().parent_path() == runs_root.lexically_normal() &&
+		    normal.parent_path().parent_path() == runs_root.lexically_normal())
+			return true;
+	}
+	return false;
+}
+
+std::vector<fs::path> read_cleanup_list(const fs::path &list_file, const std::vector<fs::path> &known_dirs, const fs::path &runs_root,
+					std::vector<std::string> &rejected)
+{
+	std::vector<fs::path> tombstones;
+
+	std::ifstream list(list_file, std::ios::binary);
+	std::string line;
+	while (std::getline(list, line)) {
+		if (line.empty())
+			continue;
+
+		const size_t tab = line.find('\t');
+		fs::path dir, tombstone;
+		try {
+			if (tab != std::string::npos)
+				dir = fs::u8path(line.substr(0, tab));
+			tombstone = fs::u8path(tab != std::string::npos ? line.substr(tab + 1) : line);
+		} catch (...) {
+			rejected.push_back(line);
+			continue;
+		}
+
+		bool known = false;
+		if (tab != std::string::npos) {
+			known = is_known_dir(dir, known_dirs, runs_root) && is_tombstone_of(tombstone, dir);
+		} else {
+			known = std::any_of(known_dirs.begin(), known_dirs.end(), [&tombstone](const fs::path &known) { return is_tombstone_of(tombstone, known); });
+		}
+		if (!known) {
+			rejected.push_back(line);
+			continue;
+		}
+
+		/* A link or junction in place of the dir would lead deletion elsewhere */
+		std::error_code ec;
+		if (fs::is_directory(fs::symlink_status(tombstone, ec)))
+			tombstones.push_back(tombstone);
+	}
+	return tombstones;
+}
+
+bool remove_tree(const fs::path &dir, const std::atomic_bool &stop, std::error_code &ec)
+{
+	/* Files are deleted as the walk finds them, directories after it, deepest first.
+	 * Links and junctions are deleted as they are, never entered */
+	std::vector<fs::path> dirs{dir};
+
+	fs::recursive_directory_iterator end;
+	for (fs::recursive_directory_iterator it(dir, fs::directory_options::none, ec); !ec && it != end; it.increment(ec)) {
+		if (stop)
+			return false;
+
+		std::error_code status_ec;
+		if (it->symlink_status(status_ec).type() == fs::file_type::directory) {
+			dirs.push_back(it->path());
+			continue;
+		}
+
+		fs::remove(it->path(), ec);
+		if (ec)
+			return false;
+	}
+	if (ec)
+		return false;
+
+	for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) {
+		if (stop)
+			return false;
+
+		fs::remove(*it, ec);
+		if (ec)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// id of the volume path is on, 0 if path cannot be opened
+uint64_t get_volume_id(const fs::path &path);
+
+/* Copies file content leaving the work to the system where it can:
+ * CopyFileEx with copy offload on Windows, copy_file_range in the kernel elsewhere.
+ * Existing target is replaced. */
+bool copy_file_offload(const fs::path &from, const fs::path &to, std::error_code &ec);
+
+/* Rename, or copy and delete when from and to are on different volumes.
+ * Sets copied when the content had to be copied. */
+bool move_file(const fs::path &from, const fs::path &to, std::error_code &ec, bool *copied = nullptr);
+
+/* Opens lock_file with no sharing and keeps it open until the process exits, so only one process at a time
+ * uses the dir it guards. Returns false when another process holds it or it cannot be created */
+bool hold_process_lock(const fs::path &lock_file, std::error_code &ec);
+
+/* Renames dir aside in its parent to be deleted later, out of the way of the update.
+ * Returns the new name, empty path if dir cannot be renamed */
+fs::path rename_to_tombstone(const fs::path &dir, std::error_code &ec);
+
+// true if path is a name rename_to_tombstone gives to dir, in the same parent
+bool is_tombstone_of(const fs::path &path, const fs::path &dir);
+
+// adds tombstone and the dir it was renamed from to a cleanup list
+void append_cleanup_list(const fs::path &list_file, const fs::path &dir, const fs::path &tombstone);
+
+/* Tombstones of a cleanup list which may be deleted. The dir an entry was renamed from has to be one of known_dirs,
+ * or have the name of one of them in another run dir under runs_root, as temp dir of every run is new.
+ * Entries without the dir are checked against known_dirs. Lines not taken are added to rejected */
+std::vector<fs::path> read_cleanup_list(const fs::path &list_file, const std::vector<fs::path> &known_dirs, const fs::path &runs_root,
+					std::vector<std::string> &rejected);
+
+/* remove_all which gives up between two files once stop is set, returns true when dir is gone.
+ * A stopped tree is left partly deleted to be finished later */
+bool remove_tree(const fs::path &dir, const std::atomic_bool &stop, std::error_code &ec);
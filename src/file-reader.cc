@@ -0,0 +1,387 @@
+#include "file-reader.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <system_error>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "logger/log.h"
+
+static const size_t read_chunk_size = 1024 * 1024;
+static const uint64_t uncached_read_threshold = 8 * 1024 * 1024;
+
+static_assert(tree_hash_chunk_size == read_chunk_size, "tree chunk has to fit one read");
+
+enum read_backend_t { read_backend_buffered, read_backend_uncached, read_backend_count };
+
+static const char *read_backend_names[read_backend_count] = {"buffered", "uncached"};
+
+struct read_stats_t {
+	std::atomic<uint64_t> files{0};
+	std::atomic<uint64_t> bytes{0};
+	std::atomic<int64_t> busy_us{0};
+};
+
+static read_stats_t read_stats[read_backend_count];
+
+struct read_buffer_deleter {
+	void operator()(uint8_t *buffer) const
+	{
+#ifdef _WIN32
+		VirtualFree(buffer, 0, MEM_RELEASE);
+#else
+		free(buffer);
+#endif
+	}
+};
+
+/* One buffer per thread for the life of the thread, page aligned
+ * which also satisfies sector alignment of unbuffered reads */
+static uint8_t *read_buffer()
+{
+	static thread_local std::unique_ptr<uint8_t, read_buffer_deleter> buffer;
+
+	if (!buffer) {
+#ifdef _WIN32
+		void *memory = VirtualAlloc(nullptr, read_chunk_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+		void *memory = aligned_alloc(4096, read_chunk_size);
+#endif
+		if (!memory)
+			throw std::bad_alloc();
+
+		buffer.reset(static_cast<uint8_t *>(memory));
+	}
+
+	return buffer.get();
+}
+
+class file_guard {
+public:
+	explicit file_guard(native_file_t file) : file(file) {}
+	~file_guard()
+	{
+#ifdef _WIN32
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (file >= 0)
+			close(file);
+#endif
+	}
+
+	file_guard(const file_guard &) = delete;
+	file_guard &operator=(const file_guard &) = delete;
+
+	native_file_t file;
+};
+
+static void query_file_info(native_file_t file, file_hash_result_t &result)
+{
+#ifdef _WIN32
+	BY_HANDLE_FILE_INFORMATION info;
+	if (GetFileInformationByHandle(file, &info)) {
+		result.size = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+		result.file_id = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+	}
+#else
+	struct stat info;
+	if (fstat(file, &info) == 0) {
+		result.size = static_cast<uint64_t>(info.st_size);
+		result.file_id = static_cast<uint64_t>(info.st_ino);
+	}
+#endif
+}
+
+static size_t read_at(native_file_t file, uint64_t offset, uint8_t *buffer, size_t length)
+{
+#ifdef _WIN32
+	OVERLAPPED overlapped{};
+	overlapped.Offset = static_cast<DWORD>(offset);
+	overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+	DWORD bytes_read = 0;
+	if (!ReadFile(file, buffer, static_cast<DWORD>(length), &bytes_read, &overlapped)) {
+		DWORD error = GetLastError();
+		if (error == ERROR_HANDLE_EOF)
+			return 0;
+		throw std::system_error(error, std::system_category(), "ReadFile");
+	}
+	return bytes_read;
+#else
+	ssize_t bytes_read;
+	do {
+		bytes_read = pread(file, buffer, length, static_cast<off_t>(offset));
+	} while (bytes_read < 0 && errno == EINTR);
+
+	if (bytes_read < 0)
+		throw std::system_error(errno, std::generic_category(), "pread");
+	return static_cast<size_t>(bytes_read);
+#endif
+}
+
+static uint64_t sha256_hash_content(native_file_t file, unsigned char digest[sha256_digest_length])
+{
+	uint8_t *buffer = read_buffer();
+	sha256_hasher hasher;
+	uint64_t offset = 0;
+
+	while (true) {
+		size_t bytes_read = read_at(file, offset, buffer, read_chunk_size);
+		if (bytes_read == 0)
+			break;
+
+		hasher.update(buffer, bytes_read);
+		offset += bytes_read;
+
+		/* Short read is the end of file, unbuffered reads could not go on from an unaligned offset anyway */
+		if (bytes_read < read_chunk_size)
+			break;
+	}
+
+	hasher.final(digest);
+	return offset;
+}
+
+static uint64_t tree_hash_content(native_file_t file, uint64_t size, task_pool *pool, unsigned char digest[sha256_digest_length])
+{
+	const size_t chunks = tree_hasher::chunk_count(size);
+	std::vector<std::array<unsigned char, sha256_digest_length>> chunk_digests(chunks);
+	std::atomic<uint64_t> bytes_total{0};
+
+	auto hash_chunk = [file, &chunk_digests, &bytes_total](size_t index) {
+		uint8_t *buffer = read_buffer();
+		size_t bytes_read = read_at(file, static_cast<uint64_t>(index) * tree_hash_chunk_size, buffer, tree_hash_chunk_size);
+
+		sha256_hasher hasher;
+		hasher.update(buffer, bytes_read);
+		hasher.final(chunk_digests[index].data());
+
+		bytes_total += bytes_read;
+	};
+
+	if (pool != nullptr && chunks > 1) {
+		task_group chunks_group;
+		for (size_t i = 0; i < chunks; i++) {
+			pool->submit(chunks_group, [&hash_chunk, i]() { hash_chunk(i); });
+		}
+		pool->wait(chunks_group);
+	} else {
+		for (size_t i = 0; i < chunks; i++) {
+			hash_chunk(i);
+		}
+	}
+
+	tree_hasher tree;
+	for (const auto &chunk_digest : chunk_digests) {
+		tree.add_chunk_digest(chunk_digest.data());
+	}
+	tree.final(digest);
+
+	return bytes_total;
+}
+
+static uint64_t hash_content(native_file_t file, file_hash_result_t &result, hash_kind kind, task_pool *pool)
+{
+	if (kind == hash_kind::tree_sha256)
+		return tree_hash_content(file, result.size, pool, result.digest.bytes);
+	return sha256_hash_content(file, result.digest.bytes);
+}
+
+static void account_read(read_backend_t backend, uint64_t bytes, std::chrono::steady_clock::time_point start_time)
+{
+	read_stats[backend].files++;
+	read_stats[backend].bytes += bytes;
+	read_stats[backend].busy_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+bool hash_file(const fs::path &path, file_read_mode mode, file_hash_result_t &result, hash_kind kind, task_pool *pool)
+{
+	auto start_time = std::chrono::steady_clock::now();
+	read_backend_t backend = read_backend_buffered;
+
+#ifdef _WIN32
+	const DWORD share_mode = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+
+	file_guard file(CreateFileW(path.c_str(), GENERIC_READ, share_mode, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+	if (file.file == INVALID_HANDLE_VALUE)
+		return false;
+
+	query_file_info(file.file, result);
+
+	/* Same file opened again around the cache, buffered handle is still there if it fails */
+	file_guard uncached(INVALID_HANDLE_VALUE);
+	if (mode == file_read_mode::uncached && result.size >= uncached_read_threshold) {
+		uncached.file = ReOpenFile(file.file, GENERIC_READ, share_mode, FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN);
+		if (uncached.file != INVALID_HANDLE_VALUE)
+			backend = read_backend_uncached;
+	}
+
+	result.size = hash_content(backend == read_backend_uncached ? uncached.file : file.file, result, kind, pool);
+#else
+	file_guard file(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+	if (file.file < 0)
+		return false;
+
+	query_file_info(file.file, result);
+	posix_fadvise(file.file, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	result.size = hash_content(file.file, result, kind, pool);
+
+	if (mode == file_read_mode::uncached && result.size >= uncached_read_threshold) {
+		posix_fadvise(file.file, 0, 0, POSIX_FADV_DONTNEED);
+		backend = read_backend_uncached;
+	}
+#endif
+
+	account_read(backend, result.size, start_time);
+	return true;
+}
+
+void hash_open_file(native_file_t file, file_hash_result_t &result, hash_kind kind)
+{
+	auto start_time = std::chrono::steady_clock::now();
+
+	query_file_info(file, result);
+	result.size = hash_content(file, result, kind, nullptr);
+
+	account_read(read_backend_buffered, result.size, start_time);
+}
+
+#ifdef _WIN32
+static file_probe_state probe_open_error(DWORD error)
+{
+	switch (error) {
+	case ERROR_FILE_NOT_FOUND:
+	case ERROR_PATH_NOT_FOUND:
+		return file_probe_state::missing;
+	case ERROR_SHARING_VIOLATION:
+	case ERROR_LOCK_VIOLATION:
+		return file_probe_state::locked;
+	case ERROR_ACCESS_DENIED:
+	case ERROR_WRITE_PROTECT:
+		return file_probe_state::read_only;
+	default:
+		return file_probe_state::failed;
+	}
+}
+#else
+/* Linux has no share modes, a file open by another process can still be replaced by rename.
+ * Only ETXTBSY and flock locks count as locked here. This only comes close to Windows for
+ * running the portable parts on Linux, the updater itself checks files on Windows */
+static file_probe_state probe_open_error(int error)
+{
+	switch (error) {
+	case ENOENT:
+	case ENOTDIR:
+		return file_probe_state::missing;
+	case ETXTBSY:
+		return file_probe_state::locked;
+	case EACCES:
+	case EPERM:
+	case EROFS:
+		return file_probe_state::read_only;
+	default:
+		return file_probe_state::failed;
+	}
+}
+#endif
+
+file_probe_state probe_file(const fs::path &path, file_read_mode mode, uint64_t size_hint, file_hash_result_t &result, hash_kind kind, task_pool *pool)
+{
+	auto start_time = std::chrono::steady_clock::now();
+	read_backend_t backend = read_backend_buffered;
+
+#ifdef _WIN32
+	/* Other readers like an antivirus scanner are let in, only a writer makes the file locked.
+	 * Unbuffered reads are aligned already, the short last read is the end of file */
+	DWORD flags = FILE_FLAG_SEQUENTIAL_SCAN;
+	if (mode == file_read_mode::uncached && size_hint >= uncached_read_threshold) {
+		flags |= FILE_FLAG_NO_BUFFERING;
+		backend = read_backend_uncached;
+	}
+
+	file_guard file(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr));
+	if (file.file == INVALID_HANDLE_VALUE) {
+		file_probe_state state = probe_open_error(GetLastError());
+		return state == file_probe_state::read_only ? file_probe_state::failed : state;
+	}
+
+	query_file_info(file.file, result);
+	result.size = hash_content(file.file, result, kind, pool);
+#else
+	(void)size_hint;
+
+	file_guard file(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+	if (file.file < 0) {
+		file_probe_state state = probe_open_error(errno);
+		return state == file_probe_state::read_only ? file_probe_state::failed : state;
+	}
+
+	/* Shared lock stands for FILE_SHARE_READ, it fails only while somebody holds an exclusive one */
+	if (flock(file.file, LOCK_SH | LOCK_NB) != 0)
+		return errno == EWOULDBLOCK ? file_probe_state::locked : file_probe_state::failed;
+
+	query_file_info(file.file, result);
+	posix_fadvise(file.file, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	result.size = hash_content(file.file, result, kind, pool);
+
+	if (mode == file_read_mode::uncached && result.size >= uncached_read_threshold) {
+		posix_fadvise(file.file, 0, 0, POSIX_FADV_DONTNEED);
+		backend = read_backend_uncached;
+	}
+#endif
+
+	account_read(backend, result.size, start_time);
+	return file_probe_state::available;
+}
+
+file_probe_state probe_file_for_replace(const fs::path &path)
+{
+#ifdef _WIN32
+	/* No sharing, same as replacing the file needs */
+	file_guard file(CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+	if (file.file == INVALID_HANDLE_VALUE)
+		return probe_open_error(GetLastError());
+#else
+	file_guard file(open(path.c_str(), O_RDWR | O_CLOEXEC));
+	if (file.file < 0)
+		return probe_open_error(errno);
+
+	/* No share modes here, an exclusive advisory lock stands for them, see probe_open_error */
+	if (flock(file.file, LOCK_EX | LOCK_NB) != 0)
+		return errno == EWOULDBLOCK ? file_probe_state::locked : file_probe_state::failed;
+#endif
+
+	return file_probe_state::available;
+}
+
+void log_file_read_stats(const char *phase)
+{
+	for (int i = 0; i < read_backend_count; i++) {
+		uint64_t files = read_stats[i].files.exchange(0);
+		uint64_t bytes = read_stats[i].bytes.exchange(0);
+		int64_t busy_us = read_stats[i].busy_us.exchange(0);
+
+		if (files == 0)
+			continue;
+
+		double gb_per_second = busy_us > 0 ? static_cast<double>(bytes) / 1000.0 / static_cast<double>(busy_us) : 0.0;
+
+		log_info("File reads %s, %s: %llu files, %.1f MiB, %.2f GB/s per thread", phase, read_backend_names[i], static_cast<unsigned long long>(files),
+			 static_cast<double>(bytes) / (1024.0 * 1024.0), gb_per_second);
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "sha256.hpp"
+#include "tree-hash.hpp"
+#include "task-pool.hpp"
+
+#include <cstdint>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace fs = std::filesystem;
+
+#ifdef _WIN32
+typedef HANDLE native_file_t;
+#else
+typedef int native_file_t;
+#endif
+
+enum class file_read_mode {
+	// data is likely in the cache already or will be read again soon, like files just written by an update
+	cached,
+	// file is read once, big files bypass the cache so they do not push out data the app needs
+	uncached
+};
+
+struct file_hash_result_t {
+	digest_t digest;
+	uint64_t size = 0;
+	uint64_t file_id = 0;
+};
+
+/* Hashes file with large sequential reads into a per thread buffer.
+ * Files up to one read are read with a single call, files from
+ * uncached_read_threshold up are read around the cache in uncached mode.
+ * Chunks of tree hashed files are read and hashed on the pool when one is given.
+ * Size and file id are taken from the same handle.
+ * Returns false if file cannot be opened, throws system_error on read errors. */
+bool hash_file(const fs::path &path, file_read_mode mode, file_hash_result_t &result, hash_kind kind = hash_kind::sha256, task_pool *pool = nullptr);
+
+/* Hashes whole content of an already open file, file position is not used or changed. */
+void hash_open_file(native_file_t file, file_hash_result_t &result, hash_kind kind = hash_kind::sha256);
+
+enum class file_probe_state {
+	// file is not there, nothing to replace
+	missing,
+	// opened as asked, nobody holds it in a conflicting way
+	available,
+	// other process has file open or locked
+	locked,
+	// file can be read but not written, like read only files
+	read_only,
+	// any other open error
+	failed
+};
+
+/* Opens a local file read only, sharing read, and hashes it from that handle.
+ * It is locked only while another process writes it. size_hint from the directory scan
+ * picks uncached reads for big files in uncached mode without a second open.
+ * Throws system_error on read errors. */
+file_probe_state probe_file(const fs::path &path, file_read_mode mode, uint64_t size_hint, file_hash_result_t &result,
+			    hash_kind kind = hash_kind::sha256, task_pool *pool = nullptr);
+
+/* Opens a local file exclusively for read and write as replacing it needs and closes it again.
+ * Only files the update is going to replace are checked this way. */
+file_probe_state probe_file_for_replace(const fs::path &path);
+
+// log files, bytes and per thread throughput of each read backend since previous call
+void log_file_read_stats(const char *phase);
@@ -1,11 +1,16 @@
 #include "update-client-internal.hpp"
 
 #include "file-updater.h"
+#include "file-ops.hpp"
 
 #include "logger/log.h"
 #include <aclapi.h>
 
-FileUpdater::FileUpdater(fs::path old_files_dir, fs::path app_dir, fs::path new_files_dir, const manifest_map_t &manifest,
+#include <algorithm>
+#include <chrono>
+#include <unordered_set>
+
+FileUpdater::FileUpdater(fs::path old_files_dir, fs::path app_dir, fs::path new_files_dir, const manifest_store &manifest,
 			 const local_manifest_t &local_manifest, update_client *client)
 	: m_new_files_dir(new_files_dir),
 	  m_old_files_dir(old_files_dir),
@@ -19,37 +24,276 @@ FileUpdater::FileUpdater(fs::path old_files_dir, fs::path app_dir, fs::path new_
 
 FileUpdater::~FileUpdater()
 {
-	std::error_code ec;
+	if (m_journal.is_open() && !m_journal.is_finished()) {
+		/* Backups are needed to roll back on next start */
+		wlog_warn(L"Update not finished, backup is kept for recovery: %s", m_old_files_dir.c_str());
+		return;
+	}
+	m_journal.remove();
 
-	fs::remove_all(m_old_files_dir, ec);
-	if (ec) {
-		wlog_warn(L"Failed to cleanup temp folder.");
+	/* Only renamed here, deleting a big backup tree would hold up app start */
+	if (!m_prev_dir.empty()) {
+		m_update_client->remove_later(m_prev_dir);
+		m_update_client->remove_later(m_next_dir);
 	}
+
+	m_update_client->remove_later(m_old_files_dir);
+	/* Files left in new files dir are not recorded any more, nothing can use them */
+	m_update_client->remove_later(m_new_files_dir);
 }
 
-void FileUpdater::update()
+void FileUpdater::create_parent_directories(const fs::path &root, const std::vector<const manifest_entry_t *> &entries)
 {
-	std::string version_file_key = "resources\app.asar";
-	manifest_map_t::const_iterator iter = m_manifest.begin();
+	std::vector<fs::path> directories;
+	directories.reserve(entries.size());
+	for (const manifest_entry_t *entry : entries) {
+		fs::path directory(root);
+		directory /= entry->path;
+		directories.push_back(directory.parent_path());
+	}
+	create_directories_once(directories);
+}
+
+void FileUpdater::create_directories_once(std::vector<fs::path> &directories)
+{
+	/* Many files share a directory, each one is created once. Sorted order creates parents before children */
+	std::sort(directories.begin(), directories.end());
+	directories.erase(std::unique(directories.begin(), directories.end()), directories.end());
 
-	while (iter != m_manifest.end()) {
-		if (version_file_key.compare(iter->first) != 0) {
-			update_entry_with_retries(iter, m_new_files_dir);
+	for (const fs::path &directory : directories) {
+		std::error_code ec;
+		fs::create_directories(directory, ec);
+		if (ec) {
+			std::wstring wmsg = ConvertToUtf16WS(ec.message());
+			wlog_warn(L"Failed to create directory: %s error, %s", directory.c_str(), wmsg.c_str());
 		}
-		++iter;
 	}
+}
+
+bool FileUpdater::check_disk_space()
+{
+	/* Tasks running out of space at once wait for one check with user */
+	std::lock_guard<std::mutex> lock(m_disk_space_mutex);
+	return m_update_client->check_disk_space();
+}
+
+void FileUpdater::update()
+{
+	auto start_time = std::chrono::steady_clock::now();
+	task_pool &tasks = m_update_client->tasks;
+
+	std::string_view version_file_key = "resources\\app.asar";
+	const manifest_entry_t *version_file = m_manifest.find(version_file_key);
+
+	std::vector<const manifest_entry_t *> entries;
+	for (const manifest_entry_t &entry : m_manifest) {
+		if (!entry.skip_update && !entry.remove_at_update)
+			entries.push_back(&entry);
+	}
+	create_parent_directories(m_app_dir, entries);
+	m_moved_files.assign(m_manifest.size(), moved_file_t());
 
-	manifest_map_t::const_iterator version_file = m_manifest.find(version_file_key);
-	if (version_file != m_manifest.end()) {
-		update_entry_with_retries(version_file, m_new_files_dir);
+	/* All moves are on disk in journal before the first one is done, in the order recovery repeats them */
+	for (const manifest_entry_t *entry : entries) {
+		if (entry != version_file)
+			m_journal.add_move(journal_op::apply, m_new_files_dir / entry->path, m_app_dir / entry->path);
 	}
+	if (version_file != nullptr && !version_file->skip_update && !version_file->remove_at_update)
+		m_journal.add_move(journal_op::apply, m_new_files_dir / version_file->path, m_app_dir / version_file->path);
+	m_journal.sync();
+
+	/* Files are moved in parallel, version file goes last once all others are in place */
+	task_group update_group;
+	std::atomic_bool failed{false};
+	for (const manifest_entry_t *entry : entries) {
+		if (entry == version_file)
+			continue;
+
+		tasks.submit(update_group, [this, entry, &failed]() {
+			if (failed)
+				return;
+
+			try {
+				update_entry_with_retries(*entry, m_new_files_dir, m_app_dir);
+			} catch (...) {
+				failed = true;
+				throw;
+			}
+		});
+	}
+	tasks.wait(update_group);
+	tasks.log_utilisation("update");
+
+	if (version_file != nullptr) {
+		update_entry_with_retries(*version_file, m_new_files_dir, m_app_dir);
+	}
+	m_journal.mark(journal_op::applied);
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+	log_info("Update moved %zu files in place, %lld ms", entries.size(), static_cast<long long>(elapsed.count()));
 
 	if (!is_local_files_updated()) {
 		throw std::runtime_error("Error: Update went not as expected");
 	}
+	m_journal.mark(journal_op::finished);
+}
+
+static fs::path sibling_dir(const fs::path &dir, const char *suffix)
+{
+	fs::path sibling = dir.has_filename() ? dir : dir.parent_path();
+	sibling += suffix;
+	return sibling;
 }
 
-void FileUpdater::update_entry_with_retries(manifest_map_t::const_iterator &iter, fs::path &new_files_dir)
+void FileUpdater::update_side_by_side()
+{
+	auto start_time = std::chrono::steady_clock::now();
+	task_pool &tasks = m_update_client->tasks;
+
+	m_next_dir = sibling_dir(m_app_dir, ".next");
+	m_prev_dir = sibling_dir(m_app_dir, ".prev");
+
+	/* Left by an earlier run, only renamed aside here */
+	m_update_client->remove_later(m_next_dir);
+	m_update_client->remove_later(m_prev_dir);
+
+	/* Files update keeps as they are get a hardlink in the new tree, changed and new ones are moved in */
+	std::vector<const local_manifest_entry_t *> links;
+	for (const auto &local_file : m_local_manifest) {
+		const manifest_entry_t *entry = m_manifest.find(local_file.key);
+		if (entry == nullptr || entry->skip_update)
+			links.push_back(&local_file);
+	}
+
+	std::vector<const manifest_entry_t *> entries;
+	for (const manifest_entry_t &entry : m_manifest) {
+		if (!entry.skip_update && !entry.remove_at_update)
+			entries.push_back(&entry);
+	}
+	m_moved_files.assign(m_manifest.size(), moved_file_t());
+
+	std::vector<fs::path> directories;
+	directories.reserve(links.size() + entries.size() + 1);
+	directories.push_back(m_next_dir);
+	for (const local_manifest_entry_t *local_file : links) {
+		directories.push_back((m_next_dir / fs::u8path(local_file->key)).parent_path());
+	}
+	for (const manifest_entry_t *entry : entries) {
+		directories.push_back((m_next_dir / entry->path).parent_path());
+	}
+	create_directories_once(directories);
+
+	task_group build_group;
+	std::atomic_bool failed{false};
+	std::atomic_size_t copied{0};
+
+	for (const local_manifest_entry_t *local_file : links) {
+		tasks.submit(build_group, [this, local_file, &failed, &copied]() {
+			if (failed)
+				return;
+
+			std::error_code ec;
+			fs::path to_path = m_next_dir / fs::u8path(local_file->key);
+			fs::create_hard_link(local_file->path, to_path, ec);
+			if (ec) {
+				/* File system without hardlinks */
+				copied++;
+				fs::copy_file(local_file->path, to_path, fs::copy_options::overwrite_existing, ec);
+			}
+			if (ec) {
+				std::wstring wmsg = ConvertToUtf16WS(ec.message());
+				wlog_warn(L"Failed to link file %s to new version, error %s", local_file->path.c_str(), wmsg.c_str());
+				failed = true;
+			}
+		});
+	}
+	for (const manifest_entry_t *entry : entries) {
+		tasks.submit(build_group, [this, entry, &failed]() {
+			if (failed)
+				return;
+
+			try {
+				update_entry_with_retries(*entry, m_new_files_dir, m_next_dir);
+			} catch (...) {
+				failed = true;
+				throw;
+			}
+		});
+	}
+	tasks.wait(build_group);
+	tasks.log_utilisation("side by side build");
+
+	if (failed)
+		throw std::runtime_error("Error: failed to build new version directory");
+
+	auto build_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+	log_info("New version built side by side, linked %zu files, copied %zu, moved %zu, %lld ms", links.size() - copied.load(), copied.load(),
+		 entries.size(), static_cast<long long>(build_elapsed.count()));
+
+	/* Switch is two directory renames, journal finishes it if updater dies between them */
+	fs::path journal_file = m_update_client->apply_journal_path();
+	if (!journal_file.empty() && m_journal.open(journal_file)) {
+		m_journal.add_move(journal_op::backup, m_app_dir, m_prev_dir);
+		m_journal.add_move(journal_op::apply, m_next_dir, m_app_dir);
+		m_journal.sync();
+	}
+
+	auto swap_start = std::chrono::steady_clock::now();
+	std::error_code ec;
+	fs::rename(m_app_dir, m_prev_dir, ec);
+	if (ec) {
+		std::wstring wmsg = ConvertToUtf16WS(ec.message());
+		wlog_warn(L"Failed to move away current version %s, error %s", m_app_dir.c_str(), wmsg.c_str());
+		throw std::runtime_error("Error: failed to switch version directory");
+	}
+
+	fs::rename(m_next_dir, m_app_dir, ec);
+	if (ec) {
+		std::wstring wmsg = ConvertToUtf16WS(ec.message());
+		wlog_warn(L"Failed to move new version in place %s, error %s", m_app_dir.c_str(), wmsg.c_str());
+		fs::rename(m_prev_dir, m_app_dir, ec);
+		throw std::runtime_error("Error: failed to switch version directory");
+	}
+	m_swapped = true;
+	m_journal.mark(journal_op::applied);
+
+	auto swap_elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - swap_start);
+	log_info("Version directory switched in %lld us", static_cast<long long>(swap_elapsed.count()));
+
+	if (!is_local_files_updated()) {
+		throw std::runtime_error("Error: Update went not as expected");
+	}
+	m_journal.mark(journal_op::finished);
+}
+
+void FileUpdater::revert_side_by_side()
+{
+	std::error_code ec;
+
+	if (m_swapped) {
+		/* Previous version comes back whole, failed one is removed with the rest of temp dirs */
+		fs::path failed_dir = sibling_dir(m_app_dir, ".failed");
+		m_update_client->remove_later(failed_dir);
+
+		fs::rename(m_app_dir, failed_dir, ec);
+		if (!ec)
+			fs::rename(m_prev_dir, m_app_dir, ec);
+
+		if (ec) {
+			std::wstring wmsg = ConvertToUtf16WS(ec.message());
+			wlog_warn(L"Revert have failed to switch back to previous version %s, error %s", m_prev_dir.c_str(), wmsg.c_str());
+			throw std::runtime_error("Revert have failed to switch back to previous version");
+		}
+
+		m_swapped = false;
+		m_next_dir = failed_dir;
+	}
+
+	/* Current version was only linked from, it is untouched until the switch */
+	m_journal.mark(journal_op::finished);
+}
+
+void FileUpdater::update_entry_with_retries(const manifest_entry_t &entry, fs::path &new_files_dir, const fs::path &to_dir)
 {
 	int retries = 0;
 	const int max_retries = 5;
@@ -58,19 +302,19 @@ void FileUpdater::update_entry_with_retries(manifest_map_t::const_iterator &iter
 	while (retries < max_retries) {
 		std::error_code ret;
 		retries++;
-		ret = update_entry(iter, new_files_dir);
+		ret = update_entry(entry, new_files_dir, to_dir);
 		if (ret == std::errc::no_space_on_device) {
-			if (m_update_client->check_disk_space()) {
+			if (check_disk_space()) {
 				retries = 1;
 				continue;
 			} else {
-				std::wstring wmsg = ConvertToUtf16WS(iter->first);
+				std::wstring wmsg = ConvertToUtf16WS(std::string(entry.key));
 				wlog_warn(L"Have failed to update file: %s, no space on device", wmsg.c_str());
 				throw std::runtime_error("Error: no space on device");
 			}
 		} else if (ret) {
 			if (retries == 1) {
-				std::wstring wmsg = ConvertToUtf16WS(iter->first);
+				std::wstring wmsg = ConvertToUtf16WS(std::string(entry.key));
 				wlog_warn(L"Have failed to update file: %s, will retry", wmsg.c_str());
 			}
 			Sleep(100 * retries);
@@ -82,22 +326,22 @@ void FileUpdater::update_entry_with_retries(manifest_map_t::const_iterator &iter
 	}
 
 	if (!is_updated) {
-		std::wstring wmsg = ConvertToUtf16WS(iter->first);
+		std::wstring wmsg = ConvertToUtf16WS(std::string(entry.key));
 		wlog_warn(L"Have failed to update file: %s", wmsg.c_str());
 		throw std::runtime_error("Error: failed to update file");
 	}
 }
 
-std::error_code FileUpdater::update_entry(manifest_map_t::const_iterator &iter, fs::path &new_files_dir)
+std::error_code FileUpdater::update_entry(const manifest_entry_t &entry, fs::path &new_files_dir, const fs::path &to_dir)
 {
 	std::error_code ec;
 
-	if (iter->second.skip_update || iter->second.remove_at_update)
+	if (entry.skip_update || entry.remove_at_update)
 		return ec;
 
 	try {
-		fs::path file_name_part = fs::u8path(iter->first.c_str());
-		fs::path to_path(m_app_dir);
+		const fs::path &file_name_part = entry.path;
+		fs::path to_path(to_dir);
 		to_path /= file_name_part;
 
 		fs::path old_file_path(m_old_files_dir);
@@ -106,21 +350,37 @@ std::error_code FileUpdater::update_entry(manifest_map_t::const_iterator &iter,
 		fs::path from_path(new_files_dir);
 		from_path /= file_name_part;
 
-		fs::create_directories(to_path.parent_path(), ec);
+		/* Rename keeps file id and size, they tell later that this file is the one in place */
+		moved_file_t &moved = m_moved_files[m_manifest.index_of(&entry)];
+		moved.file_id = get_file_id(from_path);
+		moved.size = fs::file_size(from_path, ec);
+		ec.clear();
+
+		bool copied = false;
+		move_file(from_path, to_path, ec, &copied);
+		if (ec && !fs::exists(to_path.parent_path())) {
+			/* Directories are created up front, one may have failed or vanished since */
+			fs::create_directories(to_path.parent_path(), ec);
+			if (ec) {
+				std::wstring wmsg = ConvertToUtf16WS(ec.message());
+				wlog_warn(L"Failed to create directory: %s error, %s", to_path.parent_path().c_str(), wmsg.c_str());
+				return ec;
+			}
+			move_file(from_path, to_path, ec, &copied);
+		}
+
 		if (ec) {
 			std::wstring wmsg = ConvertToUtf16WS(ec.message());
-			wlog_warn(L"Failed to create directory: %s error, %s", to_path.parent_path().c_str(), wmsg.c_str());
+			wlog_debug(L"Failed to move file %s %s, error %s", from_path.c_str(), to_path.c_str(), wmsg.c_str());
 		} else {
-			fs::rename(from_path, to_path, ec);
-			if (ec) {
-				std::wstring wmsg = ConvertToUtf16WS(ec.message());
-				wlog_debug(L"Failed to move file %s %s, error %s", from_path.c_str(), to_path.c_str(), wmsg.c_str());
-			} else {
-				try {
-					reset_rights(to_path);
-				} catch (...) {
-					wlog_warn(L"Have failed to update file rights: %s", to_path.c_str());
-				}
+			/* A copy is a new file */
+			if (copied)
+				moved.file_id = get_file_id(to_path);
+			moved.moved = true;
+			try {
+				reset_rights(to_path);
+			} catch (...) {
+				wlog_warn(L"Have failed to update file rights: %s", to_path.c_str());
 			}
 		}
 	} catch (...) {
@@ -146,141 +406,296 @@ bool FileUpdater::reset_rights(const fs::path &path)
 
 void FileUpdater::revert()
 {
-	/* Generate the manifest for the current application directory */
-	fs::recursive_directory_iterator iter(m_old_files_dir);
-	fs::recursive_directory_iterator end_iter{};
-	std::error_code ec;
-	int error_count = 0;
-
-	for (; iter != end_iter; ++iter) {
-		if (fs::is_directory(iter->path())) {
+	auto start_time = std::chrono::steady_clock::now();
+	task_pool &tasks = m_update_client->tasks;
+
+	/* Only files this run has moved are touched, backups are known without reading old-files back */
+	std::vector<const manifest_entry_t *> entries;
+	std::unordered_set<std::string> restored_keys;
+	for (const manifest_entry_t &entry : m_manifest) {
+		const size_t index = m_manifest.index_of(&entry);
+		const bool backed_up = index < m_backed_up.size() && m_backed_up[index];
+		const bool moved = index < m_moved_files.size() && m_moved_files[index].moved;
+		if (!backed_up && !moved)
 			continue;
+
+		entries.push_back(&entry);
+		if (backed_up)
+			restored_keys.insert(fs::path(entry.path).make_preferred().u8string());
+	}
+
+	task_group revert_group;
+	std::atomic_int error_count{0};
+	for (const manifest_entry_t *entry : entries) {
+		tasks.submit(revert_group, [this, entry, &error_count]() {
+			if (!revert_entry(*entry))
+				error_count++;
+		});
+	}
+	tasks.wait(revert_group);
+	tasks.log_utilisation("revert");
+
+	auto restore_time = std::chrono::steady_clock::now();
+	bool changed = error_count > 0 || is_local_files_changed(restored_keys);
+
+	auto elapsed = [](std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+		return static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count());
+	};
+	auto end_time = std::chrono::steady_clock::now();
+	log_info("Revert of %zu files, restored %zu, restore %lld ms, verify %lld ms, total %lld ms", entries.size(), restored_keys.size(),
+		 elapsed(start_time, restore_time), elapsed(restore_time, end_time), elapsed(start_time, end_time));
+
+	if (changed) {
+		wlog_warn(L"Revert have failed to correctly revert some files. Fails: %i", error_count.load());
+		throw std::runtime_error("Revert have failed to correctly revert some files");
+	}
+	m_journal.mark(journal_op::finished);
+}
+
+bool FileUpdater::revert_entry(const manifest_entry_t &entry)
+{
+	const size_t index = m_manifest.index_of(&entry);
+
+	fs::path to_path(m_app_dir);
+	to_path /= entry.path;
+
+	std::error_code ec;
+	if (index >= m_backed_up.size() || !m_backed_up[index]) {
+		/* File is new in this version, nothing was there before */
+		fs::remove(to_path, ec);
+		if (ec) {
+			wlog_warn(L"Revert have failed to remove new file: %s ", to_path.c_str());
+			return false;
 		}
-		/* Fetch relative paths */
-		fs::path rel_path(fs::relative(iter->path(), m_old_files_dir));
+		return true;
+	}
 
-		fs::path to_path(m_app_dir);
-		to_path /= rel_path;
+	fs::path old_file_path(m_old_files_dir);
+	old_file_path /= entry.path;
 
+	/* Rename replaces the updated file in one step, it is removed first only if that fails */
+	if (!move_file(old_file_path, to_path, ec)) {
 		fs::remove(to_path, ec);
 		if (ec) {
 			wlog_warn(L"Revert have failed to correctly remove changed file: %s ", to_path.c_str());
-			error_count++;
+			return false;
 		}
 
-		fs::rename(iter->path(), to_path, ec);
+		move_file(old_file_path, to_path, ec);
 		if (ec) {
 			wlog_warn(L"Revert have failed to correctly move file back: %s ", to_path.c_str());
-			error_count++;
+			return false;
 		}
 	}
 
-	if (error_count > 0 || is_local_files_changed()) {
-		wlog_warn(L"Revert have failed to correctly revert some files. Fails: %i", error_count);
-		throw std::exception("Revert have failed to correctly revert some files");
-	}
+	return true;
 }
 
 bool FileUpdater::backup()
 {
-	manifest_map_t::const_iterator iter = m_manifest.begin();
-	while (iter != m_manifest.end()) {
-		if (iter->second.skip_update || !iter->second.compared_to_local) {
-			iter++;
-			continue;
+	auto start_time = std::chrono::steady_clock::now();
+	task_pool &tasks = m_update_client->tasks;
+
+	std::vector<const manifest_entry_t *> entries;
+	for (const manifest_entry_t &entry : m_manifest) {
+		if (!entry.skip_update && entry.compared_to_local)
+			entries.push_back(&entry);
+	}
+	create_parent_directories(m_old_files_dir, entries);
+
+	fs::path journal_file = m_update_client->apply_journal_path();
+	if (!journal_file.empty() && m_journal.open(journal_file)) {
+		for (const manifest_entry_t *entry : entries) {
+			m_journal.add_move(journal_op::backup, m_app_dir / entry->path, m_old_files_dir / entry->path);
 		}
+		m_journal.sync();
+	}
 
-		try {
-			std::error_code ec;
-			fs::path file_name_part = fs::u8path(iter->first.c_str());
-			fs::path to_path(m_app_dir);
-			to_path /= file_name_part;
+	m_backed_up.assign(m_manifest.size(), 0);
 
-			fs::path old_file_path(m_old_files_dir);
-			old_file_path /= file_name_part;
+	task_group backup_group;
+	std::atomic_bool failed{false};
+	for (const manifest_entry_t *entry : entries) {
+		tasks.submit(backup_group, [this, entry, &failed]() {
+			if (failed)
+				return;
 
-			fs::create_directories(old_file_path.parent_path(), ec);
-			fs::create_directories(to_path.parent_path(), ec);
+			if (!backup_entry(*entry))
+				failed = true;
+		});
+	}
+	tasks.wait(backup_group);
+	tasks.log_utilisation("backup");
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+	log_info("Backup moved %zu files, %lld ms", entries.size(), static_cast<long long>(elapsed.count()));
 
-			if (fs::exists(to_path, ec)) {
-				fs::rename(to_path, old_file_path, ec);
-				if (ec == std::errc::no_space_on_device) {
-					std::wstring wmsg = ConvertToUtf16WS(ec.message());
-					wlog_error(L"Failed to backup entry %s to %s, not enough space, error %s", to_path.c_str(), old_file_path.c_str(),
-						   wmsg.c_str());
-					if (m_update_client->check_disk_space()) {
-						continue;
-					} else {
-						return false;
-					}
-				} else if (ec) {
-					std::wstring wmsg = ConvertToUtf16WS(ec.message());
-					wlog_debug(L"Failed to backup entry %s to %s, error %s", to_path.c_str(), old_file_path.c_str(), wmsg.c_str());
+	return !failed;
+}
+
+bool FileUpdater::backup_entry(const manifest_entry_t &entry)
+{
+	try {
+		fs::path to_path(m_app_dir);
+		to_path /= entry.path;
+
+		fs::path old_file_path(m_old_files_dir);
+		old_file_path /= entry.path;
+
+		while (true) {
+			std::error_code ec;
+			if (!fs::exists(to_path, ec)) {
+				wlog_error(L"File selected for update %s does not exist anymore, backup not possible", to_path.c_str());
+				return false;
+			}
+
+			move_file(to_path, old_file_path, ec);
+			if (ec == std::errc::no_space_on_device) {
+				std::wstring wmsg = ConvertToUtf16WS(ec.message());
+				wlog_error(L"Failed to backup entry %s to %s, not enough space, error %s", to_path.c_str(), old_file_path.c_str(), wmsg.c_str());
+				if (check_disk_space()) {
+					continue;
+				} else {
 					return false;
 				}
-			} else {
-				wlog_error(L"File selected for update %s does not exist anymore, backup not possible", to_path.c_str());
+			} else if (ec) {
+				std::wstring wmsg = ConvertToUtf16WS(ec.message());
+				wlog_debug(L"Failed to backup entry %s to %s, error %s", to_path.c_str(), old_file_path.c_str(), wmsg.c_str());
 				return false;
 			}
-		} catch (...) {
-			return false;
+
+			/* Each task writes its own byte, revert reads them after the pool is done */
+			m_backed_up[m_manifest.index_of(&entry)] = 1;
+			return true;
 		}
-		++iter;
+	} catch (...) {
+		return false;
 	}
+}
 
-	return true;
+bool FileUpdater::is_deep_verify_sample(std::string_view key) const
+{
+	/* Same files are picked on each run, spread over the whole tree */
+	const int percent = m_update_client->params->deep_verify_percent;
+	return percent > 0 && static_cast<int>(std::hash<std::string_view>()(key) % 100) < percent;
 }
 
-bool FileUpdater::is_local_files_changed()
+bool FileUpdater::is_local_files_changed(const std::unordered_set<std::string> &restored_keys)
 {
+	task_pool &tasks = m_update_client->tasks;
+	task_group verify_group;
+	std::atomic_bool changed{false};
+	std::atomic_size_t hashed{0};
+
+	/* Files update did not touch are left as they were, restored ones are moved back whole,
+	 * so the file id and size taken by the scan tell if the right file is back in place */
 	for (auto &file : m_local_manifest) {
-		std::error_code ec;
-		if (!fs::exists(file.first, ec)) {
-			wlog_error(L"File %s does not exist after revert", file.first.c_str());
-			return true;
-		} else {
-			std::string checksum = calculate_files_checksum_safe(file.first);
-			if (checksum != file.second) {
-				std::wstring checksum_expected = ConvertToUtf16WS(file.second);
-				std::wstring checksum_now = ConvertToUtf16WS(checksum);
-				wlog_error(L"File %s checksum mismatch after revert, expected %s, now %s", file.first.c_str(), checksum_expected.c_str(),
+		if (restored_keys.count(file.key) == 0)
+			continue;
+
+		tasks.submit(verify_group, [this, &file, &changed, &hashed, &tasks]() {
+			if (changed)
+				return;
+
+			std::error_code ec;
+			if (!fs::exists(file.path, ec)) {
+				wlog_error(L"File %s does not exist after revert", file.path.c_str());
+				changed = true;
+				return;
+			}
+
+			if (file.file_id != 0 && !is_deep_verify_sample(file.key)) {
+				uintmax_t size = fs::file_size(file.path, ec);
+				if (ec || size != file.size) {
+					wlog_error(L"File %s is not the original one after revert", file.path.c_str());
+					changed = true;
+					return;
+				}
+				/* Backup copied back from another volume is a new file, its content is checked instead */
+				if (get_file_id(file.path) == file.file_id)
+					return;
+			}
+
+			hashed++;
+			digest_t checksum = calculate_files_checksum_safe(file.path, file_read_mode::cached, nullptr, file.kind, &tasks);
+			if (checksum != file.hash_sum) {
+				std::wstring checksum_expected = ConvertToUtf16WS(format_hash_sum(file.kind, file.hash_sum));
+				std::wstring checksum_now = ConvertToUtf16WS(format_hash_sum(file.kind, checksum));
+				wlog_error(L"File %s checksum mismatch after revert, expected %s, now %s", file.path.c_str(), checksum_expected.c_str(),
 					   checksum_now.c_str());
-				return true;
+				changed = true;
 			}
-		}
+		});
 	}
+	tasks.wait(verify_group);
+	tasks.log_utilisation("revert verify");
+	log_file_read_stats("revert verify");
 
-	log_info("Check of files checksums after revert: passed.");
+	if (changed)
+		return true;
+
+	log_info("Check of files after revert: passed, restored %zu, hashed again %zu.", restored_keys.size(), hashed.load());
 	return false;
 }
 
 bool FileUpdater::is_local_files_updated()
 {
-	for (manifest_map_t::const_iterator iter = m_manifest.begin(); iter != m_manifest.end(); ++iter) {
-		if (iter->second.skip_update) {
+	task_pool &tasks = m_update_client->tasks;
+	task_group verify_group;
+	std::atomic_bool failed{false};
+	std::atomic_size_t hashed{0};
+
+	for (const manifest_entry_t &entry : m_manifest) {
+		if (entry.skip_update) {
 			continue;
 		}
 
-		std::error_code ec;
-		fs::path file_name_part = fs::u8path(iter->first.c_str());
-		fs::path to_path(m_app_dir);
-		to_path /= file_name_part;
+		tasks.submit(verify_group, [this, &entry, &failed, &hashed, &tasks]() {
+			if (failed)
+				return;
 
-		if (iter->second.remove_at_update) {
-			if (fs::exists(to_path, ec)) {
-				wlog_error(L"File %s still not exist after update, something went wrong", to_path.c_str());
-				return false;
+			std::error_code ec;
+			fs::path to_path(m_app_dir);
+			to_path /= entry.path;
+
+			if (entry.remove_at_update) {
+				if (fs::exists(to_path, ec)) {
+					wlog_error(L"File %s still not exist after update, something went wrong", to_path.c_str());
+					failed = true;
+				}
+				return;
 			}
-		}
 
-		std::string checksum = calculate_files_checksum_safe(to_path);
-		if (checksum != iter->second.hash_sum) {
-			log_error("File %s checksum mismatch after an update, expected %s, now %s", iter->first.c_str(), iter->second.hash_sum.c_str(),
-				  checksum.c_str());
-			return false;
-		}
+			/* Content was checked while it was downloaded, id and size prove the move landed */
+			const moved_file_t &moved = m_moved_files[m_manifest.index_of(&entry)];
+			if (entry.download_verified && moved.moved && moved.file_id != 0 && !is_deep_verify_sample(entry.key)) {
+				uintmax_t size = fs::file_size(to_path, ec);
+				if (ec || size != moved.size) {
+					log_error("File %s is not the one moved in place by update", std::string(entry.key).c_str());
+					failed = true;
+					return;
+				}
+				/* File copied across volumes somewhere on the way gets a new id, its content is checked instead */
+				if (get_file_id(to_path) == moved.file_id)
+					return;
+			}
+
+			hashed++;
+			digest_t checksum = calculate_files_checksum_safe(to_path, file_read_mode::cached, nullptr, entry.kind, &tasks);
+			if (checksum != entry.hash_sum) {
+				log_error("File %s checksum mismatch after an update, expected %s, now %s", std::string(entry.key).c_str(),
+					  format_hash_sum(entry.kind, entry.hash_sum).c_str(), format_hash_sum(entry.kind, checksum).c_str());
+				failed = true;
+			}
+		});
 	}
+	tasks.wait(verify_group);
+	tasks.log_utilisation("update verify");
+	log_file_read_stats("update verify");
 
-	log_info("Check of files checksums after update: passed.");
+	if (failed)
+		return false;
+
+	log_info("Check of files after update: passed, hashed again %zu.", hashed.load());
 	return true;
-}
\ No newline at end of file
+}
@@ -1,8 +1,13 @@
 #pragma once
 
 #include "utils.hpp"
+#include "apply-journal.hpp"
 
 #include <filesystem>
+#include <mutex>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
 namespace fs = std::filesystem;
 
 struct update_client;
@@ -14,7 +19,7 @@ struct FileUpdater {
 	FileUpdater &operator=(const FileUpdater &) = delete;
 	FileUpdater &operator=(FileUpdater &&) = delete;
 
-	explicit FileUpdater(fs::path old_files_dir, fs::path app_dir, fs::path new_files_dir, const manifest_map_t &manifest,
+	explicit FileUpdater(fs::path old_files_dir, fs::path app_dir, fs::path new_files_dir, const manifest_store &manifest,
 			     const local_manifest_t &local_manifest, update_client *client);
 	~FileUpdater();
 
@@ -22,18 +27,48 @@ struct FileUpdater {
 	void revert();
 	bool backup();
 
+	/* Other apply mode: new version is built in a sibling of app_dir with unchanged files hardlinked,
+	 * then the directories are switched by rename. Backup is not needed, revert switches back */
+	void update_side_by_side();
+	void revert_side_by_side();
+
 private:
-	std::error_code update_entry(manifest_map_t::const_iterator &iter, fs::path &new_files_dir);
-	void update_entry_with_retries(manifest_map_t::const_iterator &iter, fs::path &new_files_dir);
+	// creates each directory needed for entries under root once
+	void create_parent_directories(const fs::path &root, const std::vector<const manifest_entry_t *> &entries);
+	void create_directories_once(std::vector<fs::path> &directories);
+	bool backup_entry(const manifest_entry_t &entry);
+	bool revert_entry(const manifest_entry_t &entry);
+	bool check_disk_space();
+	std::error_code update_entry(const manifest_entry_t &entry, fs::path &new_files_dir, const fs::path &to_dir);
+	void update_entry_with_retries(const manifest_entry_t &entry, fs::path &new_files_dir, const fs::path &to_dir);
 	bool reset_rights(const fs::path &path);
-	bool is_local_files_changed();
+	// checks files moved back by revert, restored_keys are their manifest keys
+	bool is_local_files_changed(const std::unordered_set<std::string> &restored_keys);
 	bool is_local_files_updated();
+	// file is hashed again after the move in deep verify mode
+	bool is_deep_verify_sample(std::string_view key) const;
 
 	fs::path m_old_files_dir;
 	fs::path m_app_dir;
 	fs::path m_new_files_dir;
+	/* Side by side mode: new version is built in next, current one is moved to prev */
+	fs::path m_next_dir;
+	fs::path m_prev_dir;
+	bool m_swapped{false};
 
-	const manifest_map_t &m_manifest;
+	const manifest_store &m_manifest;
 	const local_manifest_t &m_local_manifest;
 	update_client *m_update_client;
+	std::mutex m_disk_space_mutex;
+	apply_journal m_journal;
+
+	struct moved_file_t {
+		uint64_t file_id = 0;
+		uintmax_t size = 0;
+		bool moved = false;
+	};
+	/* New files by manifest index, taken just before each one is moved in place */
+	std::vector<moved_file_t> m_moved_files;
+	/* Entries moved to old-files by backup, by manifest index, revert restores exactly these */
+	std::vector<uint8_t> m_backed_up;
 };
@@ -0,0 +1,200 @@
+#include "hash-cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "logger/log.h"
+
+static const char hash_cache_magic[8] = {'S', 'L', 'U', 'P', 'H', 'C', 'H', 'E'};
+static const uint32_t hash_cache_version = 1;
+
+static uint64_t hash_app_dir(const fs::path &app_dir)
+{
+	/* FNV-1a, only used to detect cache made for other install */
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : app_dir.u8string()) {
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+bool file_hash_cache::load(const fs::path &cache_file, const fs::path &app_dir)
+{
+	std::error_code ec;
+	if (!fs::exists(cache_file, ec))
+		return false;
+
+	try {
+		m_file.open(cache_file.native());
+	} catch (const std::exception &e) {
+		log_warn("Failed to map local files hash cache: %s", e.what());
+		return false;
+	}
+
+	if (!m_file.is_open() || m_file.size() < sizeof(hash_cache_header_t))
+		return false;
+
+	hash_cache_header_t header;
+	memcpy(&header, m_file.data(), sizeof(header));
+
+	if (memcmp(header.magic, hash_cache_magic, sizeof(hash_cache_magic)) != 0 || header.version != hash_cache_version) {
+		log_warn("Local files hash cache has unknown format, ignoring it");
+		m_file.close();
+		return false;
+	}
+
+	if (header.app_dir_hash != hash_app_dir(app_dir)) {
+		log_info("Local files hash cache was made for other app dir, ignoring it");
+		m_file.close();
+		return false;
+	}
+
+	uint64_t records_end = sizeof(hash_cache_header_t) + static_cast<uint64_t>(header.count) * sizeof(hash_cache_record_t);
+	if (records_end > header.keys_offset || header.keys_offset > m_file.size()) {
+		log_warn("Local files hash cache is truncated, ignoring it");
+		m_file.close();
+		return false;
+	}
+
+	m_records = reinterpret_cast<const hash_cache_record_t *>(m_file.data() + sizeof(hash_cache_header_t));
+	m_count = header.count;
+
+	log_info("Loaded local files hash cache with %u entries", m_count);
+	return true;
+}
+
+void file_hash_cache::close()
+{
+	m_records = nullptr;
+	m_count = 0;
+
+	if (m_file.is_open())
+		m_file.close();
+}
+
+std::string_view file_hash_cache::record_key(const hash_cache_record_t &record) const
+{
+	const uint64_t keys_size = m_file.size();
+	if (record.key_offset > keys_size || record.key_length > keys_size - record.key_offset)
+		return {};
+
+	return std::string_view(m_file.data() + record.key_offset, record.key_length);
+}
+
+const hash_cache_record_t *file_hash_cache::find(std::string_view key) const
+{
+	if (m_records == nullptr)
+		return nullptr;
+
+	const hash_cache_record_t *end = m_records + m_count;
+	const hash_cache_record_t *found =
+		std::lower_bound(m_records, end, key, [this](const hash_cache_record_t &record, std::string_view value) { return record_key(record) < value; });
+
+	if (found == end || record_key(*found) != key)
+		return nullptr;
+
+	return found;
+}
+
+bool file_hash_cache::lookup(local_manifest_entry_t &file, hash_kind kind) const
+{
+	const hash_cache_record_t *record = find(file.key);
+	if (record == nullptr)
+		return false;
+
+	if (record->kind != static_cast<uint32_t>(kind))
+		return false;
+
+	if (record->size != file.size || record->mtime != static_cast<int64_t>(file.mtime.time_since_epoch().count()))
+		return false;
+
+	if (file.file_id == 0)
+		file.file_id = get_file_id(file.path);
+
+	if (record->file_id != file.file_id)
+		return false;
+
+	memcpy(file.hash_sum.bytes, record->sha256, sizeof(record->sha256));
+	file.kind = kind;
+	return true;
+}
+
+bool file_hash_cache::save(const fs::path &cache_file, const fs::path &app_dir, std::vector<const local_manifest_entry_t *> &files)
+{
+	std::vector<hash_cache_record_t> records;
+	std::string keys;
+
+	std::sort(files.begin(), files.end(), [](const local_manifest_entry_t *a, const local_manifest_entry_t *b) { return a->key < b->key; });
+
+	records.reserve(files.size());
+	const std::string *last_key = nullptr;
+	for (const local_manifest_entry_t *file : files) {
+		hash_cache_record_t record{};
+
+		if (last_key != nullptr && *last_key == file->key)
+			continue;
+		if (file->hash_sum.empty())
+			continue;
+		last_key = &file->key;
+
+		memcpy(record.sha256, file->hash_sum.bytes, sizeof(record.sha256));
+		record.kind = static_cast<uint32_t>(file->kind);
+
+		record.key_offset = keys.size();
+		record.key_length = static_cast<uint32_t>(file->key.size());
+		record.size = file->size;
+		record.mtime = static_cast<int64_t>(file->mtime.time_since_epoch().count());
+		record.file_id = file->file_id;
+
+		keys += file->key;
+		records.push_back(record);
+	}
+
+	hash_cache_header_t header{};
+	memcpy(header.magic, hash_cache_magic, sizeof(hash_cache_magic));
+	header.version = hash_cache_version;
+	header.count = static_cast<uint32_t>(records.size());
+	header.app_dir_hash = hash_app_dir(app_dir);
+	header.keys_offset = sizeof(hash_cache_header_t) + records.size() * sizeof(hash_cache_record_t);
+
+	for (auto &record : records) {
+		record.key_offset += header.keys_offset;
+	}
+
+	std::error_code ec;
+	fs::create_directories(cache_file.parent_path(), ec);
+
+	/* Write aside and rename so a crash never leaves a half written cache */
+	fs::path temp_file = cache_file;
+	temp_file += ".tmp";
+	{
+		std::ofstream out(temp_file, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) {
+			log_warn("Failed to create local files hash cache");
+			return false;
+		}
+
+		out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(hash_cache_record_t));
+		out.write(keys.data(), keys.size());
+
+		if (!out.good()) {
+			log_warn("Failed to write local files hash cache");
+			out.close();
+			fs::remove(temp_file, ec);
+			return false;
+		}
+	}
+
+	fs::rename(temp_file, cache_file, ec);
+	if (ec) {
+		log_warn("Failed to replace local files hash cache: %s", ec.message().c_str());
+		fs::remove(temp_file, ec);
+		return false;
+	}
+
+	log_info("Saved local files hash cache with %zu entries", records.size());
+	return true;
+}
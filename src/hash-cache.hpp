@@ -0,0 +1,70 @@
+#pragma once
+
+#include "utils.hpp"
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <filesystem>
+#include <string_view>
+
+namespace fs = std::filesystem;
+
+/* Persistent cache of local files checksums.
+ *
+ * File layout, all fields little endian:
+ *   hash_cache_header_t
+ *   hash_cache_record_t[count] sorted by key
+ *   keys blob, records point into it
+ *
+ * Records are fixed size and sorted so the file is used
+ * directly from a read only mapping without parsing. */
+
+struct hash_cache_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint64_t app_dir_hash;
+	uint64_t keys_offset;
+};
+
+struct hash_cache_record_t {
+	uint64_t key_offset;
+	uint32_t key_length;
+	/* hash_kind of the digest, zero in caches written before tree hashes */
+	uint32_t kind;
+	uint64_t size;
+	int64_t mtime;
+	uint64_t file_id;
+	uint8_t sha256[32];
+};
+
+static_assert(sizeof(hash_cache_header_t) == 32, "hash cache header layout changed");
+static_assert(sizeof(hash_cache_record_t) == 72, "hash cache record layout changed");
+
+class file_hash_cache {
+public:
+	file_hash_cache() = default;
+	file_hash_cache(const file_hash_cache &) = delete;
+	file_hash_cache &operator=(const file_hash_cache &) = delete;
+
+	// return false if cache file missing, malformed or made for other app_dir
+	bool load(const fs::path &cache_file, const fs::path &app_dir);
+	void close();
+
+	// return true and set hash_sum if cached metadata matches the file and digest is of given kind
+	bool lookup(local_manifest_entry_t &file, hash_kind kind = hash_kind::sha256) const;
+
+	size_t size() const { return m_count; }
+
+	// write records for all given files what have checksum
+	// mapping of the same cache file have to be closed before
+	static bool save(const fs::path &cache_file, const fs::path &app_dir, std::vector<const local_manifest_entry_t *> &files);
+
+private:
+	const hash_cache_record_t *find(std::string_view key) const;
+	std::string_view record_key(const hash_cache_record_t &record) const;
+
+	boost::iostreams::mapped_file_source m_file;
+	const hash_cache_record_t *m_records{nullptr};
+	uint32_t m_count{0};
+};
@@ -0,0 +1,101 @@
+#include "local-scanner.hpp"
+
+#include <chrono>
+#include <exception>
+#include <unordered_set>
+
+#include "logger/log.h"
+
+struct scan_result_t {
+	std::vector<local_manifest_entry_t> files;
+	std::exception_ptr error;
+};
+
+static void add_scanned_file(const fs::path &app_dir, const fs::directory_entry &entry, std::vector<local_manifest_entry_t> &files)
+{
+	std::error_code ec;
+
+	/* directory_entry caches the attributes fetched by the
+	 * iterator so this does not cost an extra syscall per file */
+	if (entry.is_directory(ec) || ec)
+		return;
+
+	/* The iterator always yields app_dir / relative, so lexical
+	 * relative is exact and avoids the canonical lookups fs::relative does */
+	fs::path key_path = entry.path().lexically_relative(app_dir);
+	key_path.make_preferred();
+
+	auto &file = files.emplace_back(entry.path(), key_path.u8string());
+	file.size = entry.file_size(ec);
+	file.mtime = entry.last_write_time(ec);
+}
+
+static void scan_directory(const fs::path &app_dir, const fs::directory_entry &dir, scan_result_t &result)
+{
+	try {
+		fs::recursive_directory_iterator dir_iter(dir.path());
+		fs::recursive_directory_iterator end_iter{};
+
+		for (; dir_iter != end_iter; ++dir_iter) {
+			add_scanned_file(app_dir, *dir_iter, result.files);
+		}
+	} catch (...) {
+		result.error = std::current_exception();
+	}
+}
+
+size_t scan_local_files(task_pool &pool, const fs::path &app_dir, local_manifest_t &local_manifest)
+{
+	auto start_time = std::chrono::steady_clock::now();
+
+	std::vector<fs::directory_entry> sub_dirs;
+	scan_result_t top_level;
+
+	for (const fs::directory_entry &entry : fs::directory_iterator(app_dir)) {
+		std::error_code ec;
+		if (entry.is_directory(ec) && !ec) {
+			sub_dirs.push_back(entry);
+		} else {
+			add_scanned_file(app_dir, entry, top_level.files);
+		}
+	}
+
+	std::vector<scan_result_t> results(sub_dirs.size());
+	task_group scan_group;
+
+	for (size_t i = 0; i < sub_dirs.size(); i++) {
+		pool.submit(scan_group, [&, i]() { scan_directory(app_dir, sub_dirs[i], results[i]); });
+	}
+	pool.wait(scan_group);
+
+	/* Scan is repeated while waiting for blockers, so keep
+	 * entries found by previous runs and only add new ones */
+	std::unordered_set<std::string> known_keys;
+	known_keys.reserve(local_manifest.size());
+	for (const auto &file : local_manifest) {
+		known_keys.insert(file.key);
+	}
+
+	size_t added = 0;
+	auto merge = [&](scan_result_t &result) {
+		if (result.error)
+			std::rethrow_exception(result.error);
+
+		for (auto &file : result.files) {
+			if (known_keys.insert(file.key).second) {
+				local_manifest.push_back(std::move(file));
+				added++;
+			}
+		}
+	};
+
+	merge(top_level);
+	for (auto &result : results) {
+		merge(result);
+	}
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+	log_info("Local scan found %zu new files in %zu directories, %lld ms", added, sub_dirs.size(), static_cast<long long>(elapsed.count()));
+
+	return added;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "utils.hpp"
+#include "task-pool.hpp"
+
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+/* Walks app_dir and appends every file not yet known to local_manifest.
+ * Top level subdirectories are walked in parallel on the pool, files are deduplicated
+ * by their manifest key and the key is computed once per entry.
+ * Directory iteration errors are rethrown as filesystem_error.
+ * Returns number of files added. */
+size_t scan_local_files(task_pool &pool, const fs::path &app_dir, local_manifest_t &local_manifest);
@@ -55,6 +55,17 @@ static void unlock(void)
 	}
 }
 
+/* Log lines come from many threads, localtime shares one buffer between them off Windows */
+static struct tm *local_time(const time_t *t, struct tm *buf)
+{
+#ifdef _WIN32
+	localtime_s(buf, t);
+	return buf;
+#else
+	return localtime_r(t, buf);
+#endif
+}
+
 void log_set_udata(void *udata)
 {
 	L.udata = udata;
@@ -91,7 +102,8 @@ void log_log(int level, const char *file, int line, const char *fmt, ...)
 
 	/* Get current time */
 	time_t t = time(NULL);
-	struct tm *lt = localtime(&t);
+	struct tm lt_buf;
+	struct tm *lt = local_time(&t, &lt_buf);
 
 	/* Log to stderr */
 	if (!L.quiet) {
@@ -138,7 +150,8 @@ void wlog_log(int level, const char *file, int line, const wchar_t *fmt, ...)
 
 	/* Get current time */
 	time_t t = time(NULL);
-	struct tm *lt = localtime(&t);
+	struct tm lt_buf;
+	struct tm *lt = local_time(&t, &lt_buf);
 
 	/* Log to stderr */
 	if (!L.quiet) {
@@ -44,8 +44,8 @@ void log_set_quiet(int enable);
 void log_log(int level, const char *file, int line, const char *fmt, ...);
 void wlog_log(int level, const char *file, int line, const wchar_t *fmt, ...);
 
-#endif
-
 #ifdef __cplusplus
 }
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include "manifest-store.hpp"
+
+#include "utils.hpp"
+#include "logger/log.h"
+
+#include <cstring>
+
+std::string_view string_arena::store(std::string_view text)
+{
+	/* There may be no chunk yet */
+	if (text.empty())
+		return std::string_view();
+
+	if (text.size() > chunk_size - m_chunk_used) {
+		/* Rest of current chunk is left unused, long strings get a chunk of their own */
+		m_chunks.emplace_back(new char[text.size() > chunk_size ? text.size() : chunk_size]);
+		m_chunk_used = 0;
+	}
+
+	char *place = m_chunks.back().get() + m_chunk_used;
+	memcpy(place, text.data(), text.size());
+	m_chunk_used += text.size();
+
+	if (text.size() > chunk_size)
+		m_chunk_used = chunk_size;
+
+	return std::string_view(place, text.size());
+}
+
+void string_arena::clear()
+{
+	m_chunks.clear();
+	m_chunk_used = chunk_size;
+}
+
+uint64_t manifest_store::hash_key(std::string_view key)
+{
+	/* FNV-1a, keys are short relative paths */
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : key) {
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+size_t manifest_store::find_slot(std::string_view key, uint64_t hash) const
+{
+	const size_t mask = m_index.size() - 1;
+	const uint32_t tag = static_cast<uint32_t>(hash >> 32);
+
+	for (size_t slot = static_cast<size_t>(hash) & mask;; slot = (slot + 1) & mask) {
+		const index_slot_t &probe = m_index[slot];
+		if (probe.index == 0)
+			return slot;
+		if (probe.hash_tag == tag && m_entries[probe.index - 1].key == key)
+			return slot;
+	}
+}
+
+void manifest_store::rehash(size_t slot_count)
+{
+	m_index.assign(slot_count, index_slot_t{0, 0});
+
+	const size_t mask = slot_count - 1;
+	for (size_t i = 0; i < m_entries.size(); i++) {
+		size_t slot = static_cast<size_t>(m_hashes[i]) & mask;
+		while (m_index[slot].index != 0)
+			slot = (slot + 1) & mask;
+
+		m_index[slot] = index_slot_t{static_cast<uint32_t>(m_hashes[i] >> 32), static_cast<uint32_t>(i + 1)};
+	}
+}
+
+void manifest_store::reserve(size_t count)
+{
+	m_entries.reserve(count);
+	m_hashes.reserve(count);
+
+	/* Index is kept at most half full */
+	size_t slot_count = 16;
+	while (slot_count < count * 2)
+		slot_count *= 2;
+
+	if (slot_count > m_index.size())
+		rehash(slot_count);
+}
+
+void manifest_store::clear()
+{
+	m_entries.clear();
+	m_hashes.clear();
+	m_index.clear();
+	m_strings.clear();
+}
+
+const manifest_entry_t *manifest_store::find(std::string_view key) const
+{
+	if (m_index.empty())
+		return nullptr;
+
+	const index_slot_t &slot = m_index[find_slot(key, hash_key(key))];
+	return slot.index == 0 ? nullptr : &m_entries[slot.index - 1];
+}
+
+manifest_entry_t *manifest_store::find(std::string_view key)
+{
+	return const_cast<manifest_entry_t *>(static_cast<const manifest_store *>(this)->find(key));
+}
+
+std::pair<manifest_entry_t *, bool> manifest_store::emplace(std::string_view key, const digest_t &hash_sum, hash_kind kind)
+{
+	if ((m_entries.size() + 1) * 2 > m_index.size())
+		rehash(m_index.empty() ? 16 : m_index.size() * 2);
+
+	const uint64_t hash = hash_key(key);
+	const size_t slot = find_slot(key, hash);
+	if (m_index[slot].index != 0)
+		return {&m_entries[m_index[slot].index - 1], false};
+
+	manifest_entry_t &entry = m_entries.emplace_back();
+	entry.key = m_strings.store(key);
+	entry.url_target = m_strings.store(fixup_uri(std::string(key)) + ".gz");
+	entry.hash_sum = hash_sum;
+	entry.kind = kind;
+
+	try {
+		entry.path = fs::u8path(entry.key.begin(), entry.key.end());
+	} catch (...) {
+		log_warn("Manifest key is not valid utf8: %.*s", static_cast<int>(key.size()), key.data());
+		entry.path = fs::path(entry.key);
+	}
+
+	m_hashes.push_back(hash);
+	m_index[slot] = index_slot_t{static_cast<uint32_t>(hash >> 32), static_cast<uint32_t>(m_entries.size())};
+
+	return {&entry, true};
+}
+
+void manifest_additions::add(std::string_view key, bool remove_at_update, bool skip_update)
+{
+	shard_t &shard = m_shards[std::hash<std::string_view>()(key) % shard_count];
+
+	std::lock_guard<std::mutex> lock(shard.mtx);
+	shard.entries.push_back(addition_t{std::string(key), remove_at_update, skip_update});
+}
+
+size_t manifest_additions::merge_into(manifest_store &store)
+{
+	size_t merged = 0;
+
+	for (shard_t &shard : m_shards) {
+		std::lock_guard<std::mutex> lock(shard.mtx);
+
+		for (const addition_t &addition : shard.entries) {
+			auto [entry, added] = store.emplace(addition.key);
+			if (!added)
+				continue;
+
+			entry->compared_to_local = true;
+			entry->remove_at_update = addition.remove_at_update;
+			entry->skip_update = addition.skip_update;
+			merged++;
+		}
+		shard.entries.clear();
+	}
+
+	return merged;
+}
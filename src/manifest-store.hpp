@@ -0,0 +1,119 @@
+#pragma once
+
+#include "digest.hpp"
+#include "tree-hash.hpp"
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct manifest_entry_t {
+	/* Manifest key as it is written in manifest, points into the store arena */
+	std::string_view key;
+	/* Key converted once to a native relative path */
+	fs::path path;
+	/* Url encoded key with .gz extension, points into the store arena */
+	std::string_view url_target;
+
+	digest_t hash_sum;
+	hash_kind kind = hash_kind::sha256;
+	bool compared_to_local = false;
+
+	bool remove_at_update = false;
+	bool skip_update = false;
+	bool download_queued = false;
+	/* Downloaded file matched hash_sum while it was written, it is not read again after the update */
+	bool download_verified = false;
+};
+
+/* Keeps manifest strings in chunks which are never moved,
+ * so views into it stay valid while the store grows. */
+class string_arena {
+public:
+	std::string_view store(std::string_view text);
+	void clear();
+
+private:
+	static constexpr size_t chunk_size = 64 * 1024;
+
+	std::vector<std::unique_ptr<char[]>> m_chunks;
+	size_t m_chunk_used{chunk_size};
+};
+
+/* Manifest entries in one dense vector in manifest order with an open addressing index by key.
+ * Adding an entry may move entries, pointers from find are valid until next emplace. */
+class manifest_store {
+public:
+	using iterator = std::vector<manifest_entry_t>::iterator;
+	using const_iterator = std::vector<manifest_entry_t>::const_iterator;
+
+	// returns existing entry and false when key is already there
+	std::pair<manifest_entry_t *, bool> emplace(std::string_view key, const digest_t &hash_sum = digest_t(), hash_kind kind = hash_kind::sha256);
+
+	manifest_entry_t *find(std::string_view key);
+	const manifest_entry_t *find(std::string_view key) const;
+
+	void reserve(size_t count);
+	void clear();
+
+	size_t size() const { return m_entries.size(); }
+	bool empty() const { return m_entries.empty(); }
+
+	size_t index_of(const manifest_entry_t *entry) const { return static_cast<size_t>(entry - m_entries.data()); }
+
+	manifest_entry_t &operator[](size_t index) { return m_entries[index]; }
+	const manifest_entry_t &operator[](size_t index) const { return m_entries[index]; }
+
+	iterator begin() { return m_entries.begin(); }
+	iterator end() { return m_entries.end(); }
+	const_iterator begin() const { return m_entries.begin(); }
+	const_iterator end() const { return m_entries.end(); }
+
+private:
+	/* Slot keeps part of key hash to skip most of string compares, index is entry position + 1, 0 for empty slot */
+	struct index_slot_t {
+		uint32_t hash_tag;
+		uint32_t index;
+	};
+
+	static uint64_t hash_key(std::string_view key);
+	size_t find_slot(std::string_view key, uint64_t hash) const;
+	void rehash(size_t slot_count);
+
+	string_arena m_strings;
+	std::vector<manifest_entry_t> m_entries;
+	std::vector<uint64_t> m_hashes;
+	std::vector<index_slot_t> m_index;
+};
+
+/* Entries for local files missing in manifest, found by checkup tasks running in parallel.
+ * Other tasks keep looking the store up meanwhile, so the store is not changed during checkup,
+ * additions are kept in shards by key hash, each under its own lock, and merged in one go after. */
+class manifest_additions {
+public:
+	void add(std::string_view key, bool remove_at_update, bool skip_update);
+	// shards are merged in order, keys already in store are left as they are
+	size_t merge_into(manifest_store &store);
+
+private:
+	struct addition_t {
+		std::string key;
+		bool remove_at_update;
+		bool skip_update;
+	};
+
+	struct alignas(64) shard_t {
+		std::mutex mtx;
+		std::vector<addition_t> entries;
+	};
+
+	static constexpr size_t shard_count = 64;
+	std::array<shard_t, shard_count> m_shards;
+};
@@ -0,0 +1,306 @@
+#include "sha256.hpp"
+
+#include <cstring>
+
+/* SHA256_PORTABLE_ONLY leaves the cpu specific kernels out, test/native builds it to compare backends */
+#if (defined(_M_X64) || defined(__x86_64__)) && !defined(SHA256_PORTABLE_ONLY)
+#define SHA256_X86_SHANI 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if (defined(_M_ARM64) || (defined(__aarch64__) && defined(__ARM_FEATURE_SHA2))) && !defined(SHA256_PORTABLE_ONLY)
+#define SHA256_ARM_CE 1
+#include <arm_neon.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SHA256_TARGET(features) __attribute__((target(features)))
+#else
+#define SHA256_TARGET(features)
+#endif
+
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be,
+	0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa,
+	0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85,
+	0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f,
+	0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t rotr(uint32_t x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_blocks_portable(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+	uint32_t w[64];
+
+	while (blocks--) {
+		for (int i = 0; i < 16; i++) {
+			w[i] = (uint32_t(data[i * 4]) << 24) | (uint32_t(data[i * 4 + 1]) << 16) | (uint32_t(data[i * 4 + 2]) << 8) | uint32_t(data[i * 4 + 3]);
+		}
+		for (int i = 16; i < 64; i++) {
+			uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+		for (int i = 0; i < 64; i++) {
+			uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+			uint32_t ch = (e & f) ^ (~e & g);
+			uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+			uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+			uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+			uint32_t t2 = s0 + maj;
+
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+
+		data += 64;
+	}
+}
+
+#ifdef SHA256_X86_SHANI
+SHA256_TARGET("sha,sse4.1,ssse3")
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+	const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	/* Instructions expect state as ABEF and CDGH */
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[0])), 0xB1);
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[4])), 0x1B);
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	while (blocks--) {
+		const __m128i abef_save = state0;
+		const __m128i cdgh_save = state1;
+		__m128i w[16];
+
+		for (int i = 0; i < 16; i++) {
+			if (i < 4) {
+				w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i * 16)), byte_swap);
+			} else {
+				__m128i msg = _mm_sha256msg1_epu32(w[i - 4], w[i - 3]);
+				msg = _mm_add_epi32(msg, _mm_alignr_epi8(w[i - 1], w[i - 2], 4));
+				w[i] = _mm_sha256msg2_epu32(msg, w[i - 1]);
+			}
+
+			__m128i msg = _mm_add_epi32(w[i], _mm_loadu_si128(reinterpret_cast<const __m128i *>(&sha256_k[i * 4])));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0E);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+
+		data += 64;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(&state[0]), state0);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(&state[4]), state1);
+}
+
+static bool cpu_has_shani()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	const bool ssse3 = (info[2] & (1 << 9)) != 0;
+	const bool sse41 = (info[2] & (1 << 19)) != 0;
+	__cpuidex(info, 7, 0);
+	const bool sha = (info[1] & (1 << 29)) != 0;
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	const bool ssse3 = (ecx & (1 << 9)) != 0;
+	const bool sse41 = (ecx & (1 << 19)) != 0;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return false;
+	const bool sha = (ebx & (1 << 29)) != 0;
+#endif
+	return ssse3 && sse41 && sha;
+}
+#endif
+
+#ifdef SHA256_ARM_CE
+static void sha256_blocks_armv8(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+	uint32x4_t state0 = vld1q_u32(&state[0]);
+	uint32x4_t state1 = vld1q_u32(&state[4]);
+
+	while (blocks--) {
+		const uint32x4_t abcd_save = state0;
+		const uint32x4_t efgh_save = state1;
+		uint32x4_t w[16];
+
+		for (int i = 0; i < 16; i++) {
+			if (i < 4) {
+				w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+			} else {
+				w[i] = vsha256su1q_u32(vsha256su0q_u32(w[i - 4], w[i - 3]), w[i - 2], w[i - 1]);
+			}
+
+			const uint32x4_t msg = vaddq_u32(w[i], vld1q_u32(&sha256_k[i * 4]));
+			const uint32x4_t abcd = state0;
+			state0 = vsha256hq_u32(state0, state1, msg);
+			state1 = vsha256h2q_u32(state1, abcd, msg);
+		}
+
+		state0 = vaddq_u32(state0, abcd_save);
+		state1 = vaddq_u32(state1, efgh_save);
+
+		data += 64;
+	}
+
+	vst1q_u32(&state[0], state0);
+	vst1q_u32(&state[4], state1);
+}
+
+static bool cpu_has_armv8_sha2()
+{
+#ifdef _WIN32
+	return IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE) != 0;
+#else
+	return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#endif
+}
+#endif
+
+struct sha256_backend_t {
+	sha256_blocks_fn blocks;
+	const char *name;
+};
+
+static sha256_backend_t select_backend()
+{
+#ifdef SHA256_X86_SHANI
+	if (cpu_has_shani())
+		return {sha256_blocks_shani, "sha-ni"};
+#endif
+#ifdef SHA256_ARM_CE
+	if (cpu_has_armv8_sha2())
+		return {sha256_blocks_armv8, "armv8-ce"};
+#endif
+	return {sha256_blocks_portable, "portable"};
+}
+
+static const sha256_backend_t &backend()
+{
+	static const sha256_backend_t selected = select_backend();
+	return selected;
+}
+
+const char *sha256_backend_name()
+{
+	return backend().name;
+}
+
+void sha256_hasher::reset()
+{
+	static const uint32_t initial_state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+	memcpy(m_state, initial_state, sizeof(m_state));
+	m_buffered = 0;
+	m_total = 0;
+}
+
+void sha256_hasher::update(const void *data, size_t length)
+{
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+	m_total += length;
+
+	if (m_buffered > 0) {
+		size_t take = sizeof(m_buffer) - m_buffered;
+		if (take > length)
+			take = length;
+
+		memcpy(m_buffer + m_buffered, bytes, take);
+		m_buffered += take;
+		bytes += take;
+		length -= take;
+
+		if (m_buffered < sizeof(m_buffer))
+			return;
+
+		backend().blocks(m_state, m_buffer, 1);
+		m_buffered = 0;
+	}
+
+	/* Whole blocks go straight from the caller buffer */
+	size_t blocks = length / 64;
+	if (blocks > 0) {
+		backend().blocks(m_state, bytes, blocks);
+		bytes += blocks * 64;
+		length -= blocks * 64;
+	}
+
+	if (length > 0) {
+		memcpy(m_buffer, bytes, length);
+		m_buffered = length;
+	}
+}
+
+void sha256_hasher::final(uint8_t digest[sha256_digest_length])
+{
+	const uint64_t total_bits = m_total * 8;
+
+	uint8_t padding[72] = {0x80};
+	size_t padding_length = (m_buffered < 56 ? 56 : 120) - m_buffered;
+	for (int i = 0; i < 8; i++) {
+		padding[padding_length + i] = static_cast<uint8_t>(total_bits >> (56 - i * 8));
+	}
+	update(padding, padding_length + 8);
+
+	for (int i = 0; i < 8; i++) {
+		digest[i * 4] = static_cast<uint8_t>(m_state[i] >> 24);
+		digest[i * 4 + 1] = static_cast<uint8_t>(m_state[i] >> 16);
+		digest[i * 4 + 2] = static_cast<uint8_t>(m_state[i] >> 8);
+		digest[i * 4 + 3] = static_cast<uint8_t>(m_state[i]);
+	}
+
+	reset();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+static constexpr size_t sha256_digest_length = 32;
+
+/* SHA-256 with the block function picked once at runtime:
+ * SHA-NI on x86-64, ARMv8 crypto extensions on arm64,
+ * portable code everywhere else. */
+class sha256_hasher {
+public:
+	sha256_hasher() { reset(); }
+
+	void reset();
+	void update(const void *data, size_t length);
+	void final(uint8_t digest[sha256_digest_length]);
+
+private:
+	uint32_t m_state[8];
+	uint8_t m_buffer[64];
+	size_t m_buffered{0};
+	uint64_t m_total{0};
+};
+
+// name of the block function in use, for the log
+const char *sha256_backend_name();
@@ -0,0 +1,192 @@
+#include "staged-files.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "logger/log.h"
+
+static const char staged_magic[8] = {'S', 'L', 'U', 'P', 'S', 'T', 'G', 'D'};
+static const uint32_t staged_version = 2;
+
+static uint64_t hash_update_version(const std::string &update_version)
+{
+	/* FNV-1a, only used to detect files staged for other version */
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : update_version) {
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static uint32_t record_checksum(const staged_record_t &record, const char *key)
+{
+	/* FNV-1a over record fields before checksum and key, enough to tell a torn write */
+	uint32_t hash = 2166136261u;
+	auto add = [&hash](const void *data, size_t length) {
+		const unsigned char *bytes = static_cast<const unsigned char *>(data);
+		for (size_t i = 0; i < length; i++) {
+			hash ^= bytes[i];
+			hash *= 16777619u;
+		}
+	};
+
+	add(&record, offsetof(staged_record_t, checksum));
+	add(key, record.key_length);
+	return hash;
+}
+
+staged_files_record::~staged_files_record()
+{
+	if (m_file)
+		fclose(m_file);
+}
+
+static int64_t now_seconds()
+{
+	return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool staged_files_record::load(const fs::path &record_file, const std::string &update_version, std::chrono::seconds max_age,
+			       std::vector<staged_file_t> &files, int64_t &created)
+{
+	files.clear();
+	created = 0;
+
+	std::error_code ec;
+	if (!fs::exists(record_file, ec))
+		return false;
+
+	std::ifstream input(record_file, std::ios::binary);
+	std::vector<char> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+	input.close();
+
+	staged_header_t header;
+	if (data.size() < sizeof(header))
+		return false;
+	memcpy(&header, data.data(), sizeof(header));
+
+	if (memcmp(header.magic, staged_magic, sizeof(staged_magic)) != 0 || header.version != staged_version) {
+		log_warn("Staged files record has unknown format, ignoring it");
+		return false;
+	}
+
+	if (header.update_version_hash != hash_update_version(update_version)) {
+		log_info("Staged files were downloaded for other version, ignoring them");
+		return false;
+	}
+
+	/* An update left unfinished for long is not likely to be resumed, its files are not kept forever */
+	const int64_t age = now_seconds() - header.created;
+	if (age < 0 || age > max_age.count()) {
+		log_info("Staged files are %lld hours old, ignoring them", static_cast<long long>(age / 3600));
+		return false;
+	}
+	created = header.created;
+
+	size_t position = sizeof(header);
+	while (data.size() - position >= sizeof(staged_record_t)) {
+		staged_record_t record;
+		memcpy(&record, data.data() + position, sizeof(record));
+		position += sizeof(record);
+
+		if (record.key_length > data.size() - position)
+			break;
+
+		const char *key = data.data() + position;
+		if (record.checksum != record_checksum(record, key)) {
+			log_warn("Staged files record is torn, %zu files read before it", files.size());
+			break;
+		}
+		position += record.key_length;
+
+		staged_file_t &file = files.emplace_back();
+		file.key.assign(key, record.key_length);
+		file.kind = static_cast<hash_kind>(record.kind);
+		memcpy(file.hash_sum.bytes, record.sha256, sizeof(record.sha256));
+		file.size = record.size;
+		file.mtime = record.mtime;
+		file.file_id = record.file_id;
+	}
+
+	return true;
+}
+
+bool staged_files_record::open(const fs::path &record_file, const std::string &update_version, int64_t created)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_path = record_file;
+
+#ifdef _WIN32
+	m_file = _wfopen(record_file.c_str(), L"wb");
+#else
+	m_file = fopen(record_file.c_str(), "wb");
+#endif
+	if (!m_file) {
+		log_warn("Failed to create staged files record, interrupted download will start over");
+		return false;
+	}
+
+	staged_header_t header;
+	memcpy(header.magic, staged_magic, sizeof(staged_magic));
+	header.version = staged_version;
+	header.reserved = 0;
+	header.update_version_hash = hash_update_version(update_version);
+	header.created = created != 0 ? created : now_seconds();
+
+	if (fwrite(&header, sizeof(header), 1, m_file) != 1 || fflush(m_file) != 0) {
+		log_warn("Failed to write staged files record");
+		fclose(m_file);
+		m_file = nullptr;
+		return false;
+	}
+	return true;
+}
+
+void staged_files_record::add(const staged_file_t &file)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_file)
+		return;
+
+	staged_record_t record{};
+	record.key_length = static_cast<uint32_t>(file.key.size());
+	record.kind = static_cast<uint32_t>(file.kind);
+	record.size = file.size;
+	record.mtime = file.mtime;
+	record.file_id = file.file_id;
+	memcpy(record.sha256, file.hash_sum.bytes, sizeof(record.sha256));
+	record.checksum = record_checksum(record, file.key.data());
+
+	/* Flushed to the system at once, a crashed process loses no record. A record lost
+	 * with the system only means one more download */
+	bool written = fwrite(&record, sizeof(record), 1, m_file) == 1 && fwrite(file.key.data(), 1, file.key.size(), m_file) == file.key.size() &&
+		       fflush(m_file) == 0;
+	if (!written) {
+		log_warn("Failed to write staged files record, it is not used any more");
+		fclose(m_file);
+		m_file = nullptr;
+		std::error_code ec;
+		fs::remove(m_path, ec);
+	}
+}
+
+void staged_files_record::remove()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_file) {
+		fclose(m_file);
+		m_file = nullptr;
+	}
+
+	if (m_path.empty())
+		return;
+
+	std::error_code ec;
+	fs::remove(m_path, ec);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "digest.hpp"
+#include "tree-hash.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/* Record of downloaded files already verified in new files dir,
+ * a run interrupted while downloading goes on from where it stopped.
+ *
+ * File layout, all fields little endian:
+ *   staged_header_t
+ *   staged_record_t, each followed by manifest key in utf8
+ *
+ * Record is appended as each download is verified. Checksum tells
+ * a record torn by a crash, reading stops at it. */
+
+struct staged_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	/* Staged files are only good for the same update version */
+	uint64_t update_version_hash;
+	/* Seconds since epoch when the first of these files was staged, a resumed record keeps it */
+	int64_t created;
+};
+
+struct staged_record_t {
+	uint32_t key_length;
+	uint32_t kind;
+	/* Metadata of staged file right after it was written, file is intact while they match */
+	uint64_t size;
+	int64_t mtime;
+	uint64_t file_id;
+	uint8_t sha256[32];
+	uint32_t checksum;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(staged_header_t) == 32, "staged files header layout changed");
+static_assert(sizeof(staged_record_t) == 72, "staged files record layout changed");
+
+struct staged_file_t {
+	std::string key;
+	hash_kind kind = hash_kind::sha256;
+	digest_t hash_sum;
+	uint64_t size{0};
+	int64_t mtime{0};
+	uint64_t file_id{0};
+};
+
+class staged_files_record {
+public:
+	staged_files_record() = default;
+	~staged_files_record();
+	staged_files_record(const staged_files_record &) = delete;
+	staged_files_record &operator=(const staged_files_record &) = delete;
+
+	// return false if record missing, malformed, made for other update version or older than max_age
+	static bool load(const fs::path &record_file, const std::string &update_version, std::chrono::seconds max_age, std::vector<staged_file_t> &files,
+			 int64_t &created);
+
+	// starts new empty record, files still good from previous one have to be added again with its created time, 0 is now
+	bool open(const fs::path &record_file, const std::string &update_version, int64_t created = 0);
+	bool is_open() const { return m_file != nullptr; }
+
+	// appends and flushes one record, called from download handlers in parallel
+	void add(const staged_file_t &file);
+	// closes and deletes record when staged files are used up
+	void remove();
+
+private:
+	std::mutex m_mutex;
+	fs::path m_path;
+	FILE *m_file{nullptr};
+};
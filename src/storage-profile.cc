@@ -0,0 +1,148 @@
+#include "storage-profile.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <fstream>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#endif
+
+const char *storage_kind_name(storage_kind kind)
+{
+	switch (kind) {
+	case storage_kind::ssd:
+		return "ssd";
+	case storage_kind::hdd:
+		return "hdd";
+	default:
+		return "unknown";
+	}
+}
+
+#ifdef _WIN32
+
+storage_kind detect_storage_kind(const fs::path &path)
+{
+	wchar_t volume_path[MAX_PATH];
+	if (!GetVolumePathNameW(path.c_str(), volume_path, MAX_PATH))
+		return storage_kind::unknown;
+
+	wchar_t volume_name[MAX_PATH];
+	if (!GetVolumeNameForVolumeMountPointW(volume_path, volume_name, MAX_PATH))
+		return storage_kind::unknown;
+
+	/* Volume device opens without the trailing backslash, with one it would be the root directory */
+	size_t name_length = wcslen(volume_name);
+	if (name_length > 0 && volume_name[name_length - 1] == L'\\')
+		volume_name[name_length - 1] = L'\0';
+
+	HANDLE volume = CreateFileW(volume_name, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+	if (volume == INVALID_HANDLE_VALUE)
+		return storage_kind::unknown;
+
+	STORAGE_PROPERTY_QUERY query{};
+	query.PropertyId = StorageDeviceSeekPenaltyProperty;
+	query.QueryType = PropertyStandardQuery;
+
+	DEVICE_SEEK_PENALTY_DESCRIPTOR seek_penalty{};
+	DWORD returned = 0;
+	BOOL ok = DeviceIoControl(volume, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &seek_penalty, sizeof(seek_penalty), &returned, nullptr);
+	CloseHandle(volume);
+
+	if (!ok || returned < sizeof(seek_penalty))
+		return storage_kind::unknown;
+
+	return seek_penalty.IncursSeekPenalty ? storage_kind::hdd : storage_kind::ssd;
+}
+
+disk_position_t get_disk_position(const fs::path &path)
+{
+	disk_position_t position;
+
+	HANDLE file = CreateFileW(path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+				  FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return position;
+
+	BY_HANDLE_FILE_INFORMATION info;
+	if (GetFileInformationByHandle(file, &info))
+		position.file_id = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+
+	/* Only the first extent is wanted, ERROR_MORE_DATA still fills it */
+	STARTING_VCN_INPUT_BUFFER start{};
+	RETRIEVAL_POINTERS_BUFFER extents{};
+	DWORD returned = 0;
+	BOOL ok = DeviceIoControl(file, FSCTL_GET_RETRIEVAL_POINTERS, &start, sizeof(start), &extents, sizeof(extents), &returned, nullptr);
+	if ((ok || GetLastError() == ERROR_MORE_DATA) && extents.ExtentCount > 0 && extents.Extents[0].Lcn.QuadPart >= 0)
+		position.first_extent = static_cast<uint64_t>(extents.Extents[0].Lcn.QuadPart);
+
+	CloseHandle(file);
+	return position;
+}
+
+#else
+
+static bool read_rotational(const std::string &block_dir, storage_kind &kind)
+{
+	std::ifstream rotational(block_dir + "/queue/rotational");
+	int value;
+	if (!(rotational >> value))
+		return false;
+
+	kind = value ? storage_kind::hdd : storage_kind::ssd;
+	return true;
+}
+
+storage_kind detect_storage_kind(const fs::path &path)
+{
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return storage_kind::unknown;
+
+	std::error_code ec;
+	fs::path block_dir = fs::canonical("/sys/dev/block/" + std::to_string(major(info.st_dev)) + ":" + std::to_string(minor(info.st_dev)), ec);
+	if (ec)
+		return storage_kind::unknown;
+
+	/* Partitions have no queue of their own, the disk is their parent */
+	storage_kind kind = storage_kind::unknown;
+	if (!read_rotational(block_dir.string(), kind))
+		read_rotational(block_dir.parent_path().string(), kind);
+
+	return kind;
+}
+
+disk_position_t get_disk_position(const fs::path &path)
+{
+	disk_position_t position;
+
+	int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (file < 0)
+		return position;
+
+	struct stat info;
+	if (fstat(file, &info) == 0)
+		position.file_id = static_cast<uint64_t>(info.st_ino);
+
+	/* Room for the header and a single extent */
+	alignas(struct fiemap) char request[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+	struct fiemap *map = reinterpret_cast<struct fiemap *>(request);
+	map->fm_length = FIEMAP_MAX_OFFSET;
+	map->fm_extent_count = 1;
+
+	if (ioctl(file, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0)
+		position.first_extent = map->fm_extents[0].fe_physical;
+
+	close(file);
+	return position;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+enum class storage_kind { unknown, ssd, hdd };
+
+const char *storage_kind_name(storage_kind kind);
+
+/* Asks the disk behind the volume of path whether it has a seek penalty.
+ * Returns unknown when the volume spans several disks or the query is not supported. */
+storage_kind detect_storage_kind(const fs::path &path);
+
+/* Where file starts on disk, reading files in this order keeps the head moving one way. */
+struct disk_position_t {
+	// start of first extent, in clusters on NTFS; 0 for files without own extents like small files kept in the MFT
+	uint64_t first_extent = 0;
+	uint64_t file_id = 0;
+
+	bool operator<(const disk_position_t &other) const
+	{
+		if (first_extent != other.first_extent)
+			return first_extent < other.first_extent;
+		return file_id < other.file_id;
+	}
+};
+
+disk_position_t get_disk_position(const fs::path &path);
@@ -0,0 +1,188 @@
+#include "task-pool.hpp"
+
+#include <string>
+
+#include "logger/log.h"
+
+static const size_t no_worker = static_cast<size_t>(-1);
+
+static thread_local task_pool *current_pool = nullptr;
+static thread_local size_t current_worker = no_worker;
+
+task_pool::task_pool(unsigned num_workers)
+{
+	if (num_workers == 0)
+		num_workers = 1;
+
+	m_stats_start = std::chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < num_workers; i++) {
+		m_workers.emplace_back(new worker_t);
+	}
+
+	for (size_t i = 0; i < m_workers.size(); i++) {
+		m_workers[i]->thread = std::thread(&task_pool::worker_loop, this, i);
+	}
+}
+
+task_pool::~task_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_idle_mtx);
+		m_stop = true;
+	}
+	m_idle.notify_all();
+
+	for (auto &worker : m_workers) {
+		if (worker->thread.joinable())
+			worker->thread.join();
+	}
+}
+
+void task_pool::submit(task_group &group, task_t task)
+{
+	group.m_pending++;
+
+	/* Workers keep tasks they spawn for themselves, others are spread round robin */
+	size_t index = current_pool == this ? current_worker : m_next_queue++ % m_workers.size();
+
+	/* Counted before push so a taker never sees the counter below zero */
+	{
+		std::lock_guard<std::mutex> lock(m_idle_mtx);
+		m_queued++;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_workers[index]->mtx);
+		m_workers[index]->tasks.push_back({std::move(task), &group});
+	}
+	m_idle.notify_one();
+}
+
+bool task_pool::take_task(size_t index, queued_task_t &task, const task_group *only_group)
+{
+	auto matches = [only_group](const queued_task_t &queued) { return only_group == nullptr || queued.group == only_group; };
+
+	if (index != no_worker) {
+		worker_t &own = *m_workers[index];
+		std::lock_guard<std::mutex> lock(own.mtx);
+		for (auto it = own.tasks.rbegin(); it != own.tasks.rend(); ++it) {
+			if (matches(*it)) {
+				task = std::move(*it);
+				own.tasks.erase(std::next(it).base());
+				m_queued--;
+				return true;
+			}
+		}
+	}
+
+	const size_t start = index == no_worker ? 0 : index + 1;
+	for (size_t i = 0; i < m_workers.size(); i++) {
+		worker_t &victim = *m_workers[(start + i) % m_workers.size()];
+		std::lock_guard<std::mutex> lock(victim.mtx);
+		for (auto it = victim.tasks.begin(); it != victim.tasks.end(); ++it) {
+			if (matches(*it)) {
+				task = std::move(*it);
+				victim.tasks.erase(it);
+				m_queued--;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void task_pool::run_task(queued_task_t &task, worker_t *worker)
+{
+	task_group *group = task.group;
+	auto start_time = std::chrono::steady_clock::now();
+
+	try {
+		task.task();
+	} catch (...) {
+		std::lock_guard<std::mutex> lock(group->m_mtx);
+		if (!group->m_error)
+			group->m_error = std::current_exception();
+	}
+	task.task = nullptr;
+
+	if (worker) {
+		worker->busy_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+		worker->tasks_done++;
+	}
+
+	/* Waiter can destroy the group right after it sees zero,
+	 * so the last touch of the group happens under its lock */
+	std::lock_guard<std::mutex> lock(group->m_mtx);
+	if (--group->m_pending == 0)
+		group->m_done.notify_all();
+}
+
+void task_pool::worker_loop(size_t index)
+{
+	current_pool = this;
+	current_worker = index;
+
+	worker_t *worker = m_workers[index].get();
+	queued_task_t task;
+
+	while (true) {
+		if (take_task(index, task)) {
+			run_task(task, worker);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_idle_mtx);
+		m_idle.wait(lock, [this] { return m_stop || m_queued.load() > 0; });
+		if (m_stop)
+			return;
+	}
+}
+
+void task_pool::wait(task_group &group)
+{
+	const size_t index = current_pool == this ? current_worker : no_worker;
+	worker_t *worker = index == no_worker ? nullptr : m_workers[index].get();
+	queued_task_t task;
+
+	/* Only tasks of the waited group are run here. A task waiting for its own subtasks
+	 * may hold a file open, unrelated tasks run inside it would nest and keep it open */
+	while (group.m_pending.load() > 0) {
+		if (take_task(index, task, &group)) {
+			run_task(task, worker);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(group.m_mtx);
+		group.m_done.wait_for(lock, std::chrono::milliseconds(5), [&group] { return group.m_pending.load() == 0; });
+	}
+
+	std::unique_lock<std::mutex> lock(group.m_mtx);
+	if (group.m_error) {
+		std::exception_ptr error = group.m_error;
+		group.m_error = nullptr;
+		lock.unlock();
+		std::rethrow_exception(error);
+	}
+}
+
+void task_pool::log_utilisation(const char *phase)
+{
+	auto now = std::chrono::steady_clock::now();
+	int64_t elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(now - m_stats_start).count();
+	m_stats_start = now;
+
+	if (elapsed_us <= 0)
+		elapsed_us = 1;
+
+	std::string report;
+	for (size_t i = 0; i < m_workers.size(); i++) {
+		int64_t busy_us = m_workers[i]->busy_us.exchange(0);
+		size_t tasks_done = m_workers[i]->tasks_done.exchange(0);
+
+		report += " #" + std::to_string(i) + " " + std::to_string(busy_us * 100 / elapsed_us) + "%/" + std::to_string(tasks_done);
+	}
+
+	log_info("Task pool %s took %lld ms, worker busy%%/tasks:%s", phase, static_cast<long long>(elapsed_us / 1000), report.c_str());
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Tasks submitted together and waited for together.
+ * First exception thrown by a task is kept and rethrown from wait. */
+class task_group {
+public:
+	task_group() = default;
+	task_group(const task_group &) = delete;
+	task_group &operator=(const task_group &) = delete;
+
+	size_t pending() const { return m_pending.load(); }
+
+private:
+	friend class task_pool;
+
+	std::atomic_size_t m_pending{0};
+	std::exception_ptr m_error;
+	std::mutex m_mtx;
+	std::condition_variable m_done;
+};
+
+/* Work stealing pool shared by local files scan, hash, verify and revert.
+ *
+ * Each worker owns a queue, takes own tasks from the back and steals
+ * from the front of other queues when it runs out of work, so one slow
+ * task does not leave a whole range of files waiting behind it.
+ * Thread waiting for a group runs queued tasks of that group too. */
+class task_pool {
+public:
+	using task_t = std::function<void()>;
+
+	explicit task_pool(unsigned num_workers = std::thread::hardware_concurrency());
+	~task_pool();
+
+	task_pool(const task_pool &) = delete;
+	task_pool &operator=(const task_pool &) = delete;
+
+	void submit(task_group &group, task_t task);
+	void wait(task_group &group);
+
+	unsigned size() const { return static_cast<unsigned>(m_workers.size()); }
+
+	// log busy time of each worker since previous call
+	void log_utilisation(const char *phase);
+
+private:
+	struct queued_task_t {
+		task_t task;
+		task_group *group;
+	};
+
+	struct worker_t {
+		std::deque<queued_task_t> tasks;
+		std::mutex mtx;
+		std::thread thread;
+		std::atomic<int64_t> busy_us{0};
+		std::atomic_size_t tasks_done{0};
+	};
+
+	void worker_loop(size_t index);
+	// any task when only_group is null
+	bool take_task(size_t index, queued_task_t &task, const task_group *only_group = nullptr);
+	void run_task(queued_task_t &task, worker_t *worker);
+
+	std::vector<std::unique_ptr<worker_t>> m_workers;
+	std::atomic_size_t m_next_queue{0};
+	std::atomic_size_t m_queued{0};
+	std::mutex m_idle_mtx;
+	std::condition_variable m_idle;
+	bool m_stop{false};
+	std::chrono::steady_clock::time_point m_stats_start;
+};
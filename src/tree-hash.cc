@@ -0,0 +1,85 @@
+#include "tree-hash.hpp"
+
+bool parse_hash_sum(const char *text, size_t length, digest_t &digest, hash_kind &kind)
+{
+	kind = hash_kind::sha256;
+
+	if (length > tree_hash_prefix_length && memcmp(text, tree_hash_prefix, tree_hash_prefix_length) == 0) {
+		kind = hash_kind::tree_sha256;
+		text += tree_hash_prefix_length;
+		length -= tree_hash_prefix_length;
+	}
+
+	return digest.parse_hex(text, length);
+}
+
+std::string format_hash_sum(hash_kind kind, const digest_t &digest)
+{
+	const size_t prefix_length = kind == hash_kind::tree_sha256 ? tree_hash_prefix_length : 0;
+
+	std::string hash_sum(prefix_length + sha256_digest_length * 2, '0');
+	memcpy(&hash_sum[0], tree_hash_prefix, prefix_length);
+	digest.format_hex(&hash_sum[prefix_length]);
+
+	return hash_sum;
+}
+
+const digest_t &empty_content_digest(hash_kind kind)
+{
+	static const digest_t sha256_empty = [] {
+		digest_t digest;
+		sha256_hasher().final(digest.bytes);
+		return digest;
+	}();
+	static const digest_t tree_sha256_empty = [] {
+		digest_t digest;
+		tree_hasher().final(digest.bytes);
+		return digest;
+	}();
+
+	return kind == hash_kind::tree_sha256 ? tree_sha256_empty : sha256_empty;
+}
+
+void tree_hasher::update(const void *data, size_t length)
+{
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+	while (length > 0) {
+		size_t take = tree_hash_chunk_size - m_chunk_filled;
+		if (take > length)
+			take = length;
+
+		m_chunk.update(bytes, take);
+		m_chunk_filled += take;
+		bytes += take;
+		length -= take;
+
+		if (m_chunk_filled == tree_hash_chunk_size)
+			finish_chunk();
+	}
+}
+
+void tree_hasher::finish_chunk()
+{
+	unsigned char chunk_digest[sha256_digest_length];
+	m_chunk.final(chunk_digest);
+	m_chunk_filled = 0;
+
+	add_chunk_digest(chunk_digest);
+}
+
+void tree_hasher::add_chunk_digest(const unsigned char digest[sha256_digest_length])
+{
+	m_root.update(digest, sha256_digest_length);
+	m_has_chunks = true;
+}
+
+void tree_hasher::final(unsigned char digest[sha256_digest_length])
+{
+	if (m_chunk_filled > 0 || !m_has_chunks)
+		finish_chunk();
+
+	m_root.final(digest);
+
+	m_has_chunks = false;
+}
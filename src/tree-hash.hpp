@@ -0,0 +1,44 @@
+#pragma once
+
+#include "sha256.hpp"
+#include "digest.hpp"
+
+#include <string>
+
+enum class hash_kind : uint32_t { sha256 = 0, tree_sha256 = 1 };
+
+/* Manifest checksums of tree hashed files carry this prefix, plain hex is SHA-256 of whole file */
+static const char tree_hash_prefix[] = "mt256:";
+static constexpr size_t tree_hash_prefix_length = sizeof(tree_hash_prefix) - 1;
+
+static constexpr size_t tree_hash_chunk_size = 1024 * 1024;
+
+// manifest checksum text, hex digest with optional kind prefix
+bool parse_hash_sum(const char *text, size_t length, digest_t &digest, hash_kind &kind);
+
+// hex digest with the prefix of its kind, as it is written in manifest
+std::string format_hash_sum(hash_kind kind, const digest_t &digest);
+
+// digest of zero length content of given kind, such files need no download
+const digest_t &empty_content_digest(hash_kind kind);
+
+/* Two level SHA-256 tree: each 1 MiB chunk of a file is hashed on its own
+ * and the root is SHA-256 of all chunk digests in order. Empty file is one empty chunk.
+ * Chunks do not depend on each other, so one big file can be hashed by several threads
+ * with add_chunk_digest, or streamed through update. */
+class tree_hasher {
+public:
+	void update(const void *data, size_t length);
+	void add_chunk_digest(const unsigned char digest[sha256_digest_length]);
+	void final(unsigned char digest[sha256_digest_length]);
+
+	static size_t chunk_count(uint64_t size) { return size == 0 ? 1 : static_cast<size_t>((size + tree_hash_chunk_size - 1) / tree_hash_chunk_size); }
+
+private:
+	void finish_chunk();
+
+	sha256_hasher m_chunk;
+	size_t m_chunk_filled{0};
+	sha256_hasher m_root;
+	bool m_has_chunks{false};
+};
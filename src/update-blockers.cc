@@ -1,141 +1,226 @@
-#include "update-blockers.hpp"
-#include "logger/log.h"
-
-#pragma comment(lib, "Rstrtmgr.lib")
-
-bool get_blockers_list(fs::path &check_path, blockers_map_t &blockers)
-{
-	bool ret = false;
-
-	DWORD dwSession = 0;
-	WCHAR szSessionKey[CCH_RM_SESSION_KEY + 1] = {0};
-	DWORD dwError;
-
-	dwError = RmStartSession(&dwSession, 0, szSessionKey);
-
-	if (dwError == ERROR_SUCCESS) {
-		PCWSTR pszFile = check_path.native().c_str();
-		dwError = RmRegisterResources(dwSession, 1, &pszFile, 0, NULL, 0, NULL);
-
-		if (dwError == ERROR_SUCCESS) {
-			DWORD dwReason = 0;
-			UINT nProcInfoNeeded;
-			UINT nProcInfo = 1;
-			RM_PROCESS_INFO *rgpi = nullptr;
-
-			dwError = ERROR_MORE_DATA;
-
-			while (dwError != ERROR_SUCCESS) {
-				if (rgpi != nullptr) {
-					delete[] rgpi;
-					rgpi = nullptr;
-				}
-
-				rgpi = new RM_PROCESS_INFO[nProcInfo];
-				dwError = RmGetList(dwSession, &nProcInfoNeeded, &nProcInfo, rgpi, &dwReason);
-
-				if (dwError != ERROR_MORE_DATA) {
-					break;
-				}
-				nProcInfo = nProcInfoNeeded;
-			}
-
-			if (dwError == ERROR_SUCCESS) {
-				for (unsigned int i = 0; i < nProcInfo; i++) {
-					std::unique_lock<std::mutex> ulock(blockers.mtx);
-					blockers.list.insert({rgpi[i].Process.dwProcessId, rgpi[i]});
-				}
-
-				ret = true;
-			} else {
-				if (dwError == 5) {
-					RM_PROCESS_INFO unknown_locker_process;
-					unknown_locker_process.Process.dwProcessId = 0;
-					const WCHAR *unknown_name = L"Unknown Process\0";
-					memcpy(unknown_locker_process.strAppName, unknown_name, 32);
-
-					std::unique_lock<std::mutex> ulock(blockers.mtx);
-					blockers.list.insert({unknown_locker_process.Process.dwProcessId, unknown_locker_process});
-					ret = true;
-				}
-				log_debug("RmGetList for (%s) returned %d", check_path.u8string().c_str(), dwError);
-			}
-
-			if (rgpi != nullptr) {
-				delete[] rgpi;
-				rgpi = nullptr;
-			}
-		} else {
-			log_debug("RmRegisterResources(%ls) returned %d", check_path.u8string().c_str(), dwError);
-		}
-
-		RmEndSession(dwSession);
-	} else {
-		log_error("RmStartSession returned %d", dwError);
-	}
-
-	return ret;
-}
-
-bool get_blockers_names(blockers_map_t &blockers)
-{
-	bool ret = true;
-	/*
-	//for each blockers 
-	HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, rgpi[i].Process.dwProcessId);
-
-	if (hProcess)
-	{
-		FILETIME ftCreate, ftExit, ftKernel, ftUser;
-		if (GetProcessTimes(hProcess, &ftCreate, &ftExit, &ftKernel, &ftUser) && CompareFileTime(&rgpi[i].Process.ProcessStartTime, &ftCreate) == 0)
-		{
-			WCHAR sz[MAX_PATH];
-			DWORD cch = MAX_PATH;
-			if (QueryFullProcessImageNameW(hProcess, 0, sz, &cch) && cch <= MAX_PATH)
-			{
-				wprintf(L"%d.Process.Name = %ls\n", i, sz);
-			}
-		}
-		CloseHandle(hProcess);
-	}
-	*/
-	return ret;
-}
-
-bool check_file_updatable(fs::path &check_path, bool check_read, blockers_map_t &blockers)
-{
-	bool ret = true;
-	const std::wstring path_str = check_path.generic_wstring();
-
-	HANDLE hFile = CreateFile(path_str.c_str(), check_read ? GENERIC_READ : GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (hFile == INVALID_HANDLE_VALUE) {
-		DWORD errorCode = GetLastError();
-
-		switch (errorCode) {
-		case ERROR_SUCCESS:
-		case ERROR_FILE_NOT_FOUND:
-		case ERROR_PATH_NOT_FOUND:
-			//its normal we can update file that not exist before
-			break;
-		case ERROR_SHARING_VIOLATION:
-		case ERROR_LOCK_VIOLATION:
-			if (get_blockers_list(check_path, blockers)) {
-				ret = false;
-			} else {
-				//if fail to get blocking process info we go old way
-				throw update_exception_blocked();
-			}
-			break;
-		case ERROR_ACCESS_DENIED:
-		case ERROR_WRITE_PROTECT:
-		case ERROR_WRITE_FAULT:
-		case ERROR_OPEN_FAILED:
-		default:
-			//its bad
-			throw update_exception_failed();
-		}
-	} else {
-		CloseHandle(hFile);
-	}
-	return ret;
-}
+#include "update-blockers.hpp"
+#include "logger/log.h"
+
+#ifdef _WIN32
+#include <RestartManager.h>
+
+#pragma comment(lib, "Rstrtmgr.lib")
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <unordered_map>
+#endif
+
+static void add_unknown_blocker(blockers_map_t &blockers)
+{
+	blocker_process_t unknown_locker_process;
+	unknown_locker_process.pid = 0;
+	unknown_locker_process.name = L"Unknown Process";
+
+	std::unique_lock<std::mutex> ulock(blockers.mtx);
+	blockers.list.insert({unknown_locker_process.pid, unknown_locker_process});
+}
+
+#ifdef _WIN32
+
+bool get_blockers_list(const std::vector<fs::path> &check_paths, blockers_map_t &blockers)
+{
+	bool ret = false;
+
+	if (check_paths.empty())
+		return true;
+
+	DWORD dwSession = 0;
+	WCHAR szSessionKey[CCH_RM_SESSION_KEY + 1] = {0};
+	DWORD dwError;
+
+	dwError = RmStartSession(&dwSession, 0, szSessionKey);
+
+	if (dwError == ERROR_SUCCESS) {
+		std::vector<PCWSTR> files;
+		files.reserve(check_paths.size());
+		for (const fs::path &check_path : check_paths) {
+			files.push_back(check_path.native().c_str());
+		}
+
+		dwError = RmRegisterResources(dwSession, static_cast<UINT>(files.size()), files.data(), 0, NULL, 0, NULL);
+
+		if (dwError == ERROR_SUCCESS) {
+			DWORD dwReason = 0;
+			UINT nProcInfoNeeded = 0;
+			UINT nProcInfo = 0;
+			std::vector<RM_PROCESS_INFO> rgpi;
+
+			dwError = ERROR_MORE_DATA;
+
+			while (dwError == ERROR_MORE_DATA) {
+				/* Some room over the needed count as the list can grow between calls */
+				rgpi.resize(nProcInfoNeeded + 4);
+				nProcInfo = static_cast<UINT>(rgpi.size());
+				dwError = RmGetList(dwSession, &nProcInfoNeeded, &nProcInfo, rgpi.data(), &dwReason);
+			}
+
+			if (dwError == ERROR_SUCCESS) {
+				std::unique_lock<std::mutex> ulock(blockers.mtx);
+				for (unsigned int i = 0; i < nProcInfo; i++) {
+					blocker_process_t blocker;
+					blocker.pid = rgpi[i].Process.dwProcessId;
+					blocker.name = rgpi[i].strAppName;
+					blockers.list.insert({blocker.pid, blocker});
+				}
+
+				ret = true;
+			} else {
+				if (dwError == ERROR_ACCESS_DENIED) {
+					add_unknown_blocker(blockers);
+					ret = true;
+				}
+				log_debug("RmGetList for %zu files returned %d", check_paths.size(), dwError);
+			}
+		} else {
+			log_debug("RmRegisterResources for %zu files returned %d", check_paths.size(), dwError);
+		}
+
+		RmEndSession(dwSession);
+	} else {
+		log_error("RmStartSession returned %d", dwError);
+	}
+
+	return ret;
+}
+
+#else
+
+namespace {
+struct file_key_t {
+	dev_t dev;
+	ino_t ino;
+
+	bool operator==(const file_key_t &other) const { return dev == other.dev && ino == other.ino; }
+};
+
+struct file_key_hash {
+	size_t operator()(const file_key_t &key) const { return std::hash<uint64_t>()(static_cast<uint64_t>(key.ino) * 31 + static_cast<uint64_t>(key.dev)); }
+};
+}
+
+static std::wstring process_name(const std::string &pid_dir)
+{
+	std::ifstream comm(pid_dir + "/comm");
+	std::string name;
+	std::getline(comm, name);
+
+	return std::wstring(name.begin(), name.end());
+}
+
+bool get_blockers_list(const std::vector<fs::path> &check_paths, blockers_map_t &blockers)
+{
+	if (check_paths.empty())
+		return true;
+
+	/* Inodes of locked files mapped to pids which have them open, filled by one pass over /proc */
+	std::unordered_map<file_key_t, std::vector<uint32_t>, file_key_hash> index;
+	for (const fs::path &check_path : check_paths) {
+		struct stat st;
+		if (stat(check_path.c_str(), &st) == 0)
+			index.emplace(file_key_t{st.st_dev, st.st_ino}, std::vector<uint32_t>());
+	}
+
+	DIR *proc = opendir("/proc");
+	if (proc == nullptr) {
+		log_error("Failed to open /proc, errno %d", errno);
+		return false;
+	}
+
+	const uint32_t self = static_cast<uint32_t>(getpid());
+	std::map<uint32_t, std::string> found;
+	size_t hidden_processes = 0;
+
+	while (dirent *process = readdir(proc)) {
+		char *end = nullptr;
+		unsigned long pid = strtoul(process->d_name, &end, 10);
+		if (end == process->d_name || *end != '\0' || pid == self)
+			continue;
+
+		std::string pid_dir = std::string("/proc/") + process->d_name;
+		std::string fd_dir = pid_dir + "/fd";
+		DIR *fds = opendir(fd_dir.c_str());
+		if (fds == nullptr) {
+			/* Processes of other users, their files cannot be told */
+			hidden_processes++;
+			continue;
+		}
+
+		while (dirent *fd = readdir(fds)) {
+			if (fd->d_name[0] == '.')
+				continue;
+
+			struct stat st;
+			if (stat((fd_dir + "/" + fd->d_name).c_str(), &st) != 0)
+				continue;
+
+			auto it = index.find(file_key_t{st.st_dev, st.st_ino});
+			if (it != index.end()) {
+				it->second.push_back(static_cast<uint32_t>(pid));
+				found.emplace(static_cast<uint32_t>(pid), pid_dir);
+			}
+		}
+		closedir(fds);
+	}
+	closedir(proc);
+
+	bool all_found = true;
+	for (const auto &locked_file : index) {
+		if (locked_file.second.empty())
+			all_found = false;
+	}
+
+	{
+		std::unique_lock<std::mutex> ulock(blockers.mtx);
+		for (const auto &process : found) {
+			blocker_process_t blocker;
+			blocker.pid = process.first;
+			blocker.name = process_name(process.second);
+			blockers.list.insert({blocker.pid, blocker});
+		}
+	}
+
+	if (!all_found) {
+		log_debug("Owner of some of %zu locked files not found, processes not readable %zu", check_paths.size(), hidden_processes);
+		add_unknown_blocker(blockers);
+	}
+
+	return true;
+}
+
+#endif
+
+bool get_blockers_names(blockers_map_t &blockers)
+{
+	(void)blockers;
+	bool ret = true;
+	/*
+	//for each blockers 
+	HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, rgpi[i].Process.dwProcessId);
+
+	if (hProcess)
+	{
+		FILETIME ftCreate, ftExit, ftKernel, ftUser;
+		if (GetProcessTimes(hProcess, &ftCreate, &ftExit, &ftKernel, &ftUser) && CompareFileTime(&rgpi[i].Process.ProcessStartTime, &ftCreate) == 0)
+		{
+			WCHAR sz[MAX_PATH];
+			DWORD cch = MAX_PATH;
+			if (QueryFullProcessImageNameW(hProcess, 0, sz, &cch) && cch <= MAX_PATH)
+			{
+				wprintf(L"%d.Process.Name = %ls\n", i, sz);
+			}
+		}
+		CloseHandle(hProcess);
+	}
+	*/
+	return ret;
+}
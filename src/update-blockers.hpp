@@ -1,18 +1,28 @@
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
-#include <RestartManager.h>
+#include <cstdint>
 #include <list>
 #include <map>
 #include <mutex>
+#include <string>
+#include <vector>
 
 #include <filesystem>
 
 namespace fs = std::filesystem;
 
+struct blocker_process_t {
+	// 0 when files are locked by a process we cannot get info on
+	uint32_t pid = 0;
+	std::wstring name;
+};
+
 struct blockers_map_t {
-	std::map<DWORD, RM_PROCESS_INFO> list;
+	std::map<uint32_t, blocker_process_t> list;
 	std::mutex mtx;
 };
 
@@ -26,12 +36,11 @@ class update_exception_failed : public std::exception {
 
 // === Update blockers check
 
-// return true if successfuly get info on blocker process
-bool get_blockers_list(fs::path &check_path, blockers_map_t &blockers);
-
-// check if file ok to read or write
-// return : false if file blocked
-// blockers list updated with blocker process info
-bool check_file_updatable(fs::path &check_path, bool check_read, blockers_map_t &blockers);
+/* Finds processes holding any of the paths open with one query for all of them,
+ * so the cost does not grow with the number of locked files.
+ * Windows backend registers all paths in one Restart Manager session,
+ * other systems look the paths up in one index of open files built from /proc.
+ * return true if successfuly get info on blocker processes */
+bool get_blockers_list(const std::vector<fs::path> &check_paths, blockers_map_t &blockers);
 
 bool get_blockers_names(blockers_map_t &blockers);
\ No newline at end of file
@@ -2,9 +2,14 @@
 #include "update-http-request.hpp"
 
 #include <fstream>
+#include <unordered_map>
 #include "utils.hpp"
 #include "checksum-filters.hpp"
 #include "update-client.hpp"
+#include "hash-cache.hpp"
+#include "staged-files.hpp"
+#include "task-pool.hpp"
+#include "storage-profile.hpp"
 
 /*##############################################
  *#
@@ -20,7 +25,7 @@ struct update_file_t {
 
 	bio::chain<bio::output> output_chain;
 
-	explicit update_file_t(const fs::path &path);
+	update_file_t(const fs::path &path, hash_kind checksum_kind);
 };
 
 struct update_client {
@@ -71,6 +76,8 @@ struct update_client {
 	update_parameters *params;
 
 	work_guard_type *work_thread_guard{nullptr};
+	/* Downloads and backups, on the same volume as app_dir so applying an update only renames */
+	fs::path staging_dir;
 	fs::path new_files_dir;
 
 	client_callbacks *client_events{nullptr};
@@ -84,11 +91,82 @@ struct update_client {
 	int active_workers{0};
 	std::atomic_size_t active_pids{0};
 	std::list<update_client::pid *> pids_waiters;
+	/* Blocker processes are waited for like pids, blocked files are probed again as soon as one exits */
+	std::list<update_client::pid *> blocker_waiters;
+
+	/* Indices in local_manifest of files found locked, only they are probed again while blockers are shown */
+	std::vector<size_t> blocked_files;
+	std::mutex blocked_files_mutex;
 
 	local_manifest_t local_manifest;
-	manifest_map_t manifest;
+	file_hash_cache hash_cache;
+	staged_files_record staged_files;
+	/* Files of an update not resumed within this time are deleted */
+	static constexpr std::chrono::hours staged_files_max_age{24 * 7};
+	std::atomic_size_t hash_cache_hits{0};
+	/* Which phase writes what in manifest entries:
+	 * - checkup tasks set compared_to_local and skip_update of the entry of their local file with no lock,
+	 *   each key belongs to one local file. Entries are not added or moved until checkup is done
+	 * - download workers and local file jobs set download_queued and download_verified under manifest_mutex.
+	 *   In pipelined mode they run during checkup, but only on entries with no local file
+	 * - the rest is written with checkup and downloads done, or under manifest_mutex
+	 * Flags are separate bools, not bit fields, so writes to different flags of one entry do not race.
+	 * test/native/client-test runs the client under thread sanitizer */
+	manifest_store manifest;
+	/* Local files missing in manifest, merged into manifest after checkup */
+	manifest_additions local_only_files;
 	std::mutex manifest_mutex;
-	manifest_map_t::const_iterator manifest_iterator;
+
+	/* Manifest indices of files to download, guarded by manifest_mutex.
+	 * Pipelined mode queues files with no local copy before checkup and the rest after it,
+	 * workers wait in idle_download_workers until the queue is complete */
+	std::vector<size_t> download_queue;
+	size_t download_position{0};
+	/* Pre-stage mode may download in two rounds, files changed before the app exited come second */
+	size_t download_round_start{0};
+	bool download_queue_complete{false};
+	bool downloads_started{false};
+	bool downloads_canceled{false};
+	std::vector<int> idle_download_workers;
+	static constexpr int max_download_workers = 4;
+
+	/* Entries with the same content are downloaded once, the others are copied from the first one
+	 * as soon as it is verified. Guarded by manifest_mutex */
+	struct content_source_t {
+		size_t index;
+		bool staged{false};
+		std::vector<size_t> copies;
+	};
+	std::unordered_map<digest_t, content_source_t, digest_hash> content_sources;
+	/* Local files by checksum found in checkup, content moved or renamed between versions is copied from them */
+	std::unordered_map<digest_t, size_t, digest_hash> local_content;
+
+	/* Staged file made from content known without a request, copied or empty */
+	struct local_file_job_t {
+		size_t index;
+		fs::path target;
+		// empty for a file of zero length
+		fs::path source;
+		// source is a verified download, a copy of app file is hashed after update
+		bool verified;
+		staged_file_t staged;
+	};
+	std::atomic_size_t local_files_made{0};
+	std::atomic_uint64_t local_bytes_made{0};
+	std::atomic_size_t app_files_copied{0};
+	std::atomic_uint64_t app_bytes_copied{0};
+
+	/* Pipelined mode scans local files while manifest downloads */
+	task_group local_scan_group;
+	bool local_scan_ready{false};
+	std::exception_ptr local_scan_error;
+
+	/* Pre-stage mode, local files are only read and changed files downloaded while the app runs.
+	 * Apply starts once both downloads are done and pids have exited */
+	std::atomic_bool prestaging{false};
+	std::mutex prestage_mutex;
+	bool prestage_downloaded{false};
+	bool prestage_pids_exited{false};
 
 	resolver_type resolver;
 	ssl::context ssl_context{ssl::context::method::sslv23_client};
@@ -101,6 +179,22 @@ struct update_client {
 
 	std::vector<std::thread> thread_pool;
 
+	/* Directories left by update are renamed aside at once and deleted by a low priority thread,
+	 * app is started meanwhile. Tombstones left by a run which exited early are deleted on next start */
+	std::mutex cleanup_mutex;
+	std::condition_variable cleanup_done;
+	std::vector<fs::path> tombstones;
+	std::thread cleanup_thread;
+	bool cleanup_running{false};
+	/* Set on exit, deletion stops after the file in hand and the cleanup list is kept */
+	std::atomic_bool cleanup_stop{false};
+	static constexpr std::chrono::seconds cleanup_wait_on_exit{2};
+
+	/* Local files scan, hash, verify and revert work */
+	task_pool tasks;
+	/* Local files are read by one thread in disk order on hdd */
+	storage_kind app_storage{storage_kind::unknown};
+
 	boost::asio::deadline_timer wait_for_blockers;
 	bool show_user_blockers_list;
 	std::wstring process_list_text;
@@ -129,11 +223,59 @@ public:
 	void handle_resolve(const boost::system::error_code &error, resolver_type::results_type results);
 	void handle_manifest_result(manifest_request<manifest_body> *request_ctx);
 	void process_manifest_results();
-	void checkup_files(struct blockers_map_t &blockers, int from, int to);
+	// body of process_manifest_results, called with manifest_result_mutex held
+	void check_manifest_results();
+	void checkup_file(struct blockers_map_t &blockers, local_manifest_entry_t &local_file);
 	void checkup_manifest(struct blockers_map_t &blockers);
+	void checkup_files_in_disk_order(struct blockers_map_t &blockers, std::vector<local_manifest_entry_t *> &files, task_group &checkup_group);
+	void checkup_blocked_files(struct blockers_map_t &blockers);
+	// one blockers query for all files left locked by checkup
+	void find_blockers(struct blockers_map_t &blockers);
+	void wait_for_blocker_processes(const struct blockers_map_t &blockers);
+	// set and return checksum of local file, from hash cache when it is still valid
+	const digest_t &local_file_checksum(local_manifest_entry_t &file, hash_kind kind = hash_kind::sha256);
+	bool cached_local_file_checksum(local_manifest_entry_t &file, hash_kind kind);
+	task_pool *local_file_chunks_pool();
+	fs::path hash_cache_path() const;
+	// empty when there is no cache dir to keep it between runs
+	fs::path apply_journal_path() const;
+	fs::path choose_staging_dir() const;
+	fs::path choose_new_files_dir() const;
+	fs::path staged_files_path() const;
+	// deletes staged files of other version or older than staged_files_max_age
+	void discard_stale_staged_files();
+	// marks entries still staged by interrupted run of the same version as downloaded
+	void resume_staged_files();
+	void recover_interrupted_update();
+	fs::path cleanup_list_path() const;
+	// renames dir to a tombstone and deletes it in background, dir is gone once this returns
+	void remove_later(const fs::path &dir);
+	// dirs this updater renames aside, a listed tombstone of anything else is not deleted
+	std::vector<fs::path> tombstone_sources() const;
+	void remove_previous_tombstones();
+	void start_cleanup_thread();
+	void remove_tombstones();
+	void save_hash_cache();
 
 	//files
+	void start_local_scan();
+	void start_early_downloads();
 	void start_downloading_files();
+	void queue_downloads(const std::vector<size_t> &indices, bool complete);
+	// called with manifest_mutex held
+	local_file_job_t local_file_job(size_t index, const manifest_entry_t *source);
+	local_file_job_t local_file_job(size_t index, const local_manifest_entry_t &source);
+	void index_local_content();
+	// return indices of files which could not be made and have to be downloaded after all
+	std::vector<size_t> make_local_files(const std::vector<local_file_job_t> &jobs);
+	void start_download_request(size_t manifest_index, int worker);
+	void cancel_downloads();
+	void finish_download_round();
+
+	//pre-stage
+	void prestage_step_done(bool downloaded);
+	void finish_prestage();
+	size_t revalidate_local_files();
 	void handle_file_result(file_request<http::dynamic_body> *request_ctx, update_file_t *file_ctx, int index);
 	void next_manifest_entry(int index);
 	void install_package(const std::string &packageName, std::string url, const std::string &startParams);
@@ -142,6 +284,7 @@ public:
 	//wait for slobs close
 	void handle_pids();
 	void handle_pid(const boost::system::error_code &error, int pid_id);
+	void handle_pids_exited();
 
 	//update
 	void start_file_update();
@@ -17,12 +17,11 @@ using std::regex;
 using std::cmatch;
 using std::regex_search;
 
-const size_t file_buffer_size = 4096;
-
 #include "update-blockers.hpp"
 
 #include "update-client.hpp"
 #include "checksum-filters.hpp"
+#include "sha256.hpp"
 #include "update-parameters.hpp"
 #include "logger/log.h"
 
@@ -30,6 +29,8 @@ const size_t file_buffer_size = 4096;
 
 #include "utils.hpp"
 #include "file-updater.h"
+#include "local-scanner.hpp"
+#include "file-ops.hpp"
 
 /*##############################################
  *#
@@ -39,18 +40,38 @@ const size_t file_buffer_size = 4096;
 
 void update_client::start_file_update()
 {
+	if (prestaging) {
+		prestage_step_done(true);
+		return;
+	}
+
 	log_info("Files downloaded and ready to start update.");
 
 	reset_work_threads_guards();
 
-	FileUpdater updater(params->temp_dir, params->app_dir, new_files_dir, manifest, local_manifest, this);
+	/* Files are moved out of new files dir from now on, a run after this one downloads again */
+	staged_files.remove();
+
+	if (local_files_made > 0)
+		log_info("Files made locally without download %zu, %llu bytes saved, copied from app dir %zu, %llu bytes", local_files_made.load(),
+			 static_cast<unsigned long long>(local_bytes_made.load()), app_files_copied.load(), static_cast<unsigned long long>(app_bytes_copied.load()));
+
+	FileUpdater updater(staging_dir, params->app_dir, new_files_dir, manifest, local_manifest, this);
 	bool updated = false;
 
 	try {
-		if (updater.backup()) {
+		bool applied = false;
+		if (params->side_by_side) {
+			updater.update_side_by_side();
+			applied = true;
+		} else if (updater.backup()) {
 			updater.update();
+			applied = true;
+		}
 
+		if (applied) {
 			log_info("Finished updating files without errors.");
+			save_hash_cache();
 			client_events->success();
 			updated = true;
 		}
@@ -64,7 +85,11 @@ void update_client::start_file_update()
 		bool reverted = false;
 		log_info("Going to revert.");
 		try {
-			updater.revert();
+			if (params->side_by_side) {
+				updater.revert_side_by_side();
+			} else {
+				updater.revert();
+			}
 			reverted = true;
 			log_info("Revert completed.");
 		} catch (std::exception &e) {
@@ -107,6 +132,15 @@ void update_client::handle_pid(const boost::system::error_code &error, int pid_i
 
 	if (--active_pids == 0) {
 		pid_events->pid_wait_complete();
+		handle_pids_exited();
+	}
+}
+
+void update_client::handle_pids_exited()
+{
+	if (prestaging) {
+		prestage_step_done(false);
+	} else {
 		process_manifest_results();
 	}
 }
@@ -116,7 +150,7 @@ void update_client::handle_pids()
 	active_pids = params->pids.size();
 
 	if (active_pids == 0) {
-		process_manifest_results();
+		handle_pids_exited();
 	}
 
 	for (auto iter = params->pids.begin(); iter != params->pids.end(); ++iter) {
@@ -130,10 +164,92 @@ void update_client::handle_pids()
 			pid_ctx->wrapper.async_wait([this, pid_ctx](auto ec) { this->handle_pid(ec, pid_ctx->id); });
 
 			pids_waiters.push_back(pid_ctx);
+		} else {
+			/* Process is gone already or cannot be waited for, it would hold up the update forever */
+			log_info("Cannot wait for pid %d, error %d", *iter, GetLastError());
+			if (--active_pids == 0) {
+				pid_events->pid_wait_complete();
+				handle_pids_exited();
+			}
 		}
 	}
 }
 
+std::mutex manifest_result_mutex;
+
+void update_client::prestage_step_done(bool downloaded)
+{
+	{
+		std::lock_guard<std::mutex> lock(prestage_mutex);
+
+		if (downloaded) {
+			prestage_downloaded = true;
+		} else {
+			prestage_pids_exited = true;
+		}
+
+		if (!prestage_downloaded || !prestage_pids_exited) {
+			log_info(downloaded ? "Update is staged, waiting for the application to exit" : "Application exited, waiting for update to be staged");
+			return;
+		}
+	}
+
+	/* Last download may finish with manifest_mutex held, apply goes on from its own handler */
+	io_ctx.post(boost::bind(&update_client::finish_prestage, this));
+}
+
+void update_client::finish_prestage()
+{
+	/* With nothing left to download this is posted from a check of manifest results which still holds the mutex.
+	 * No other event follows, so it waits for that check instead of being skipped like timer and pid events */
+	std::lock_guard<std::mutex> lock(manifest_result_mutex);
+
+	prestaging = false;
+
+	size_t changed = revalidate_local_files();
+	log_info("Pre-staged update revalidated, local files changed since checkup %zu", changed);
+
+	/* Normal checkup takes over: locks and blockers are checked, only changed files
+	 * are hashed again and files which are not staged yet are downloaded */
+	check_manifest_results();
+}
+
+size_t update_client::revalidate_local_files()
+{
+	task_group revalidate_group;
+	std::atomic_size_t changed{0};
+
+	for (auto &local_file : local_manifest) {
+		if (local_file.hash_sum.empty())
+			continue;
+
+		tasks.submit(revalidate_group, [this, &local_file, &changed]() {
+			std::error_code ec;
+			fs::directory_entry dir_entry(local_file.path, ec);
+			uintmax_t size = ec ? 0 : dir_entry.file_size(ec);
+			fs::file_time_type mtime = ec ? fs::file_time_type() : dir_entry.last_write_time(ec);
+
+			if (!ec && size == local_file.size && mtime == local_file.mtime)
+				return;
+
+			changed++;
+			local_file.size = size;
+			local_file.mtime = mtime;
+			local_file.hash_sum = digest_t();
+
+			/* Entries of local only files carry no digest and stay as they are */
+			manifest_entry_t *manifest_entry = manifest.find(local_file.key);
+			if (manifest_entry != nullptr && !manifest_entry->hash_sum.empty()) {
+				manifest_entry->compared_to_local = false;
+				manifest_entry->skip_update = false;
+			}
+		});
+	}
+	tasks.wait(revalidate_group);
+
+	return changed;
+}
+
 void update_client::handle_network_error(const boost::system::error_code &error, const std::string &str)
 {
 	std::lock_guard<std::mutex> lock(handle_error_mutex);
@@ -177,6 +293,8 @@ void update_client::handle_file_download_error(file_request<http::dynamic_body>
 	} else {
 		auto new_request_ctx = new file_request<http::dynamic_body>{this, request_ctx->target, request_ctx->worker_id};
 		new_request_ctx->retries = request_ctx->retries + 1;
+		new_request_ctx->checksum_kind = request_ctx->checksum_kind;
+		new_request_ctx->manifest_index = request_ctx->manifest_index;
 
 		delete request_ctx;
 
@@ -265,14 +383,30 @@ void update_client::handle_resolve(const boost::system::error_code &error, resol
 update_client::update_client(struct update_parameters *params)
 	: params(params), wait_for_blockers(io_ctx), show_user_blockers_list(true), active_workers(0), resolver(io_ctx), domain_resolve_timeout(io_ctx)
 {
-	new_files_dir = params->temp_dir;
-	new_files_dir /= "new-files";
+	staging_dir = choose_staging_dir();
+	new_files_dir = choose_new_files_dir();
 
 	this->ssl_context.set_verify_mode(ssl::verify_none);
 	this->ssl_context.set_default_verify_paths();
 
 	fs::create_directories(new_files_dir);
 
+	log_info("SHA-256 backend: %s", sha256_backend_name());
+
+	if (params->storage_profile != storage_kind::unknown) {
+		app_storage = params->storage_profile;
+		log_info("Storage profile set to %s", storage_kind_name(app_storage));
+	} else {
+		app_storage = detect_storage_kind(params->app_dir);
+		log_info("Storage profile detected as %s", storage_kind_name(app_storage));
+	}
+
+	if (params->verify_files) {
+		log_info("Verification mode, local files hash cache will not be used.");
+	} else if (!params->cache_dir.empty()) {
+		hash_cache.load(hash_cache_path(), params->app_dir);
+	}
+
 	const unsigned num_workers = std::thread::hardware_concurrency();
 
 	create_work_threads_guards();
@@ -285,6 +419,301 @@ update_client::update_client(struct update_parameters *params)
 update_client::~update_client()
 {
 	reset_work_threads_guards();
+
+	/* Staging next to app and new files in cache dir are not cleaned with temp dir.
+	 * Journal still needs backups in them, staged files record lets next run resume download */
+	std::error_code ec;
+	fs::path journal_file = apply_journal_path();
+	if ((journal_file.empty() || !fs::exists(journal_file, ec)) && !fs::exists(staged_files_path(), ec)) {
+		remove_later(new_files_dir);
+		if (staging_dir != params->temp_dir)
+			remove_later(staging_dir);
+	}
+
+	/* App is started by now. Deletion goes on only a moment longer, the rest stays listed for next run */
+	std::unique_lock<std::mutex> lock(cleanup_mutex);
+	if (!cleanup_done.wait_for(lock, cleanup_wait_on_exit, [this]() { return !cleanup_running; }))
+		log_info("Background deletion is not done, rest of it is left to next run");
+	cleanup_stop = true;
+	lock.unlock();
+
+	if (cleanup_thread.joinable())
+		cleanup_thread.join();
+}
+
+fs::path update_client::cleanup_list_path() const
+{
+	if (params->cache_dir.empty())
+		return fs::path();
+
+	fs::path list_file = params->cache_dir;
+	list_file /= "cleanup.list";
+	return list_file;
+}
+
+void update_client::remove_later(const fs::path &dir)
+{
+	std::error_code ec;
+	if (!fs::exists(dir, ec))
+		return;
+
+	fs::path tombstone = rename_to_tombstone(dir, ec);
+	if (tombstone.empty()) {
+		std::wstring wmsg = ConvertToUtf16WS(ec.message());
+		wlog_warn(L"Failed to rename %s aside, deleting it now, error %s", dir.c_str(), wmsg.c_str());
+		fs::remove_all(dir, ec);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(cleanup_mutex);
+
+	/* Listed before deletion starts, a run which exits early leaves it to the next one */
+	fs::path list_file = cleanup_list_path();
+	if (!list_file.empty())
+		append_cleanup_list(list_file, dir, tombstone);
+
+	tombstones.push_back(tombstone);
+	start_cleanup_thread();
+}
+
+/* Default temp dir of each run is a new dir in here, see fetch_default_temp_dir */
+static fs::path updater_temp_root()
+{
+	std::error_code ec;
+	fs::path root = fs::temp_directory_path(ec);
+	if (ec)
+		return fs::path();
+	return root / "slobs-updater";
+}
+
+std::vector<fs::path> update_client::tombstone_sources() const
+{
+	std::vector<fs::path> dirs;
+
+	/* Side by side versions and staging dir next to app dir */
+	const fs::path app_dir = params->app_dir.has_filename() ? params->app_dir : params->app_dir.parent_path();
+	for (const char *suffix : {".next", ".prev", ".failed", ".staging"}) {
+		fs::path sibling = app_dir;
+		sibling += suffix;
+		dirs.push_back(sibling);
+	}
+
+	/* Backups and downloads, staging may have been in temp dir or next to app dir in previous run */
+	fs::path app_staging = app_dir;
+	app_staging += ".staging";
+	std::vector<fs::path> bases = {staging_dir, app_staging};
+	if (!params->cache_dir.empty())
+		bases.push_back(params->cache_dir);
+
+	for (const fs::path &base : bases) {
+		dirs.push_back(base / "old-files");
+		dirs.push_back(base / "new-files");
+	}
+
+	return dirs;
+}
+
+void update_client::remove_previous_tombstones()
+{
+	fs::path list_file = cleanup_list_path();
+	std::error_code ec;
+	if (list_file.empty() || !fs::exists(list_file, ec))
+		return;
+
+	std::lock_guard<std::mutex> lock(cleanup_mutex);
+
+	/* List is in user temp dir, anybody may have written to it. Only names this updater gives to the dirs it
+	 * renames aside are deleted, an elevated run must not delete whatever tree is listed there.
+	 * Temp dir of a previous run had another name, its dirs are taken by the name they have in this run */
+	std::vector<std::string> rejected;
+	tombstones = read_cleanup_list(list_file, tombstone_sources(), updater_temp_root(), rejected);
+	for (const std::string &line : rejected) {
+		log_warn("Cleanup list entry is not a dir renamed aside by updater, skipping it: %s", line.c_str());
+	}
+
+	if (tombstones.empty()) {
+		fs::remove(list_file, ec);
+		return;
+	}
+
+	log_info("Deleting %zu directories left by previous run", tombstones.size());
+	start_cleanup_thread();
+}
+
+void update_client::start_cleanup_thread()
+{
+	/* Called with cleanup_mutex held */
+	if (cleanup_running)
+		return;
+
+	if (cleanup_thread.joinable())
+		cleanup_thread.join();
+
+	cleanup_running = true;
+	cleanup_thread = std::thread([this]() { remove_tombstones(); });
+}
+
+void update_client::remove_tombstones()
+{
+	/* Background priority lowers disk priority as well, app start and update are not slowed down */
+	SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+	auto start_time = std::chrono::steady_clock::now();
+	size_t removed = 0;
+
+	std::unique_lock<std::mutex> lock(cleanup_mutex);
+	while (!tombstones.empty() && !cleanup_stop) {
+		fs::path tombstone = tombstones.back();
+		tombstones.pop_back();
+		lock.unlock();
+
+		std::error_code ec;
+		if (remove_tree(tombstone, cleanup_stop, ec)) {
+			removed++;
+		} else if (ec) {
+			std::wstring wmsg = ConvertToUtf16WS(ec.message());
+			wlog_warn(L"Failed to delete %s, error %s", tombstone.c_str(), wmsg.c_str());
+		}
+
+		lock.lock();
+	}
+
+	/* Tombstones which failed to delete now are dropped from the list, a restart is unlikely to unlock them.
+	 * A stopped deletion keeps the list, next run finishes it */
+	if (!cleanup_stop) {
+		std::error_code ec;
+		fs::path list_file = cleanup_list_path();
+		if (!list_file.empty())
+			fs::remove(list_file, ec);
+	}
+
+	cleanup_running = false;
+	cleanup_done.notify_all();
+	lock.unlock();
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+	log_info("Deleted %zu directories in background, %lld ms%s", removed, static_cast<long long>(elapsed.count()), cleanup_stop ? ", stopped on exit" : "");
+}
+
+fs::path update_client::choose_staging_dir() const
+{
+	const uint64_t app_volume = get_volume_id(params->app_dir);
+	const uint64_t temp_volume = get_volume_id(params->temp_dir);
+
+	if (app_volume == 0 || temp_volume == 0 || app_volume == temp_volume)
+		return params->temp_dir;
+
+	/* Temp dir is on another volume, moving files from it would copy them */
+	fs::path staging = params->app_dir.has_filename() ? params->app_dir : params->app_dir.parent_path();
+	staging += ".staging";
+
+	std::error_code ec;
+	fs::create_directories(staging, ec);
+	if (!ec && get_volume_id(staging) == app_volume) {
+		wlog_info(L"Temp dir is on another volume than app dir, staging in %s", staging.c_str());
+		return staging;
+	}
+
+	wlog_warn(L"Failed to create staging dir on app volume %s, files will be copied from temp dir", staging.c_str());
+	return params->temp_dir;
+}
+
+fs::path update_client::choose_new_files_dir() const
+{
+	/* Temp dir is new for each run, cache dir keeps downloaded files for next run if it is on the same volume */
+	if (staging_dir == params->temp_dir && !params->cache_dir.empty()) {
+		const uint64_t cache_volume = get_volume_id(params->cache_dir);
+		const uint64_t staging_volume = get_volume_id(staging_dir);
+
+		if (cache_volume == 0 || staging_volume == 0 || cache_volume == staging_volume)
+			return params->cache_dir / "new-files";
+	}
+
+	return staging_dir / "new-files";
+}
+
+fs::path update_client::staged_files_path() const
+{
+	fs::path record_file = new_files_dir;
+	record_file += ".record";
+	return record_file;
+}
+
+static bool read_staged_metadata(const fs::path &path, staged_file_t &file)
+{
+	std::error_code ec;
+	file.size = fs::file_size(path, ec);
+	if (ec)
+		return false;
+
+	file.mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+	if (ec)
+		return false;
+
+	file.file_id = get_file_id(path);
+	return true;
+}
+
+void update_client::discard_stale_staged_files()
+{
+	const fs::path record_file = staged_files_path();
+
+	std::vector<staged_file_t> previous;
+	int64_t created = 0;
+	if (staged_files_record::load(record_file, params->version, staged_files_max_age, previous, created))
+		return;
+
+	/* Files of other version, too old or from a run without record, nothing in there is known to be whole.
+	 * New files dir may be in cache dir and hold gigabytes, it goes on start even if this run gets no further */
+	std::error_code ec;
+	fs::remove(record_file, ec);
+	if (!fs::is_empty(new_files_dir, ec)) {
+		remove_later(new_files_dir);
+		fs::create_directories(new_files_dir, ec);
+	}
+}
+
+void update_client::resume_staged_files()
+{
+	const fs::path record_file = staged_files_path();
+
+	/* Stale files were discarded on start, a record still there is for this version */
+	std::vector<staged_file_t> previous;
+	int64_t created = 0;
+	staged_files_record::load(record_file, params->version, staged_files_max_age, previous, created);
+
+	if (!staged_files.open(record_file, params->version, created))
+		return;
+
+	size_t resumed = 0;
+	uint64_t resumed_bytes = 0;
+
+	std::lock_guard<std::mutex> manifest_lock(manifest_mutex);
+	for (const staged_file_t &file : previous) {
+		manifest_entry_t *entry = manifest.find(file.key);
+		if (entry == nullptr || entry->download_queued || entry->kind != file.kind || entry->hash_sum != file.hash_sum)
+			continue;
+
+		staged_file_t staged;
+		if (!read_staged_metadata(new_files_dir / entry->path, staged) || staged.size != file.size || staged.mtime != file.mtime ||
+		    staged.file_id != file.file_id)
+			continue;
+
+		if (params->verify_files && calculate_files_checksum_safe(new_files_dir / entry->path, file_read_mode::cached, nullptr, file.kind) != file.hash_sum)
+			continue;
+
+		entry->download_queued = true;
+		entry->download_verified = true;
+		staged_files.add(file);
+		content_sources.try_emplace(entry->hash_sum, content_source_t{manifest.index_of(entry), true});
+
+		resumed++;
+		resumed_bytes += file.size;
+	}
+
+	if (!previous.empty())
+		log_info("Resumed %zu of %zu staged files, %llu bytes not downloaded again", resumed, previous.size(),
+			 static_cast<unsigned long long>(resumed_bytes));
 }
 
 void update_client::create_work_threads_guards()
@@ -319,7 +748,7 @@ bool update_client::check_disk_space()
 	uintmax_t temp_dir_free_space_prev;
 	while (true) {
 		uintmax_t app_dir_free_space = fs::space(params->app_dir, ec).available;
-		uintmax_t temp_dir_free_space = fs::space(params->temp_dir, ec).available;
+		uintmax_t temp_dir_free_space = fs::space(staging_dir, ec).available;
 
 		if (app_dir_free_space < MIN_FREE_SPACE || temp_dir_free_space < MIN_FREE_SPACE) {
 			if (!notified) {
@@ -338,7 +767,7 @@ bool update_client::check_disk_space()
 					temp_dir_free_space_prev = temp_dir_free_space;
 				}
 
-				int command = disk_space_events->disk_space_waiting_for(params->app_dir.c_str(), app_dir_free_space, params->temp_dir.c_str(),
+				int command = disk_space_events->disk_space_waiting_for(params->app_dir.wstring(), app_dir_free_space, staging_dir.wstring(),
 											temp_dir_free_space, skip_update);
 				switch (command) {
 				case 0:
@@ -367,6 +796,11 @@ void update_client::do_stuff()
 {
 	auto cb = [=](auto e, auto i) { this->handle_resolve(e, i); };
 
+	/* Previous run died while moving files, app dir is made whole again before anything reads it */
+	recover_interrupted_update();
+	remove_previous_tombstones();
+	discard_stale_staged_files();
+
 	if (!check_disk_space())
 		return;
 
@@ -380,6 +814,9 @@ void update_client::do_stuff()
 	log_info("Ready to resolve cdn address \"%s\" and \"%s\" ", params->host.authority.c_str(), params->host.scheme.c_str());
 
 	resolver.async_resolve(params->host.authority, params->host.scheme, cb);
+
+	if (params->pipelined)
+		start_local_scan();
 }
 
 void update_client::install_package(const std::string &packageName, std::string url, const std::string &startParams)
@@ -578,107 +1015,366 @@ void update_client::check_resolve_timeout_callback_err(const boost::system::erro
  *#
  *############################################*/
 
-void update_client::checkup_files(struct blockers_map_t &blockers, int from, int to)
+void update_client::checkup_file(struct blockers_map_t &blockers, local_manifest_entry_t &local_file)
 {
-	for (int i = from; i < to; i++) {
-		fs::path entry = local_manifest.at(i).first;
-		fs::path key_path(fs::relative(entry, params->app_dir));
+	fs::path &entry = local_file.path;
+	const std::string &key = local_file.key;
 
-		fs::path cleaned_file_name = key_path.make_preferred();
-		std::string key = cleaned_file_name.u8string();
+	/* Manifest is only read during checkup. Each key belongs to one local file,
+	 * so flags of an entry are changed by one task only */
+	manifest_entry_t *manifest_entry = manifest.find(key);
 
-		auto manifest_iter = manifest.find(key);
+	if (manifest_entry == nullptr) {
+		if (params->enable_removing_old_files) {
+			if (key.find("Uninstall") == 0 || key.find("installername") == 0) {
+				local_only_files.add(key, false, true);
+			} else {
+				local_only_files.add(key, true, false);
+			}
 
-		if (manifest_iter == manifest.end()) {
-			if (params->enable_removing_old_files) {
-				auto entry_update_info = manifest_entry_t(std::string(""));
-				entry_update_info.compared_to_local = true;
-				entry_update_info.remove_at_update = true;
+			local_file_checksum(local_file);
+		} else {
+			if (local_file.hash_sum.empty())
+				local_file_checksum(local_file);
+		}
+		return;
+	}
 
-				if (key.find("Uninstall") == 0 || key.find("installername") == 0) {
-					entry_update_info.remove_at_update = false;
-					entry_update_info.skip_update = true;
-				}
+	if (prestaging) {
+		/* Application still runs, files are only read. Locks are checked once it exits,
+		 * files not read now are compared then */
+		if (!manifest_entry->compared_to_local) {
+			const digest_t &checksum = local_file_checksum(local_file, manifest_entry->kind);
+			if (checksum.empty())
+				return;
 
-				manifest.emplace(std::make_pair(key, entry_update_info));
+			manifest_entry->compared_to_local = true;
+			if (checksum == manifest_entry->hash_sum)
+				manifest_entry->skip_update = true;
+		}
+		return;
+	}
 
-				local_manifest.at(i).second = calculate_files_checksum_safe(entry);
-			} else {
-				if(local_manifest.at(i).second.empty())
-					local_manifest.at(i).second = calculate_files_checksum_safe(entry);
-			}
-			continue;
+	/* Content is compared from a shared read open, other readers of unchanged files do not matter */
+	const hash_kind kind = manifest_entry->kind;
+	const bool needs_hash = !manifest_entry->compared_to_local && !cached_local_file_checksum(local_file, kind);
+
+	if (needs_hash) {
+		file_hash_result_t probe_hash;
+		file_probe_state state;
+		try {
+			state = probe_file(entry, file_read_mode::uncached, local_file.size, probe_hash, kind, local_file_chunks_pool());
+		} catch (const std::exception &e) {
+			/* File was opened, it is left to the update to replace it */
+			log_warn("Failed to calculate checksum of local file. std::exception: %s", e.what());
+			state = file_probe_state::available;
+			probe_hash.digest = digest_t();
 		}
 
-		if (check_file_updatable(entry, true, blockers)) {
-			if (!manifest_iter->second.compared_to_local) {
-				std::string checksum = calculate_files_checksum_safe(entry);
+		if (state == file_probe_state::locked) {
+			/* Blocker processes of all locked files are found in one query after checkup */
+			std::lock_guard<std::mutex> lock(blocked_files_mutex);
+			blocked_files.push_back(static_cast<size_t>(&local_file - local_manifest.data()));
+			return;
+		}
 
-				manifest_iter->second.compared_to_local = true;
-				local_manifest.at(i).second = checksum;
+		if (state == file_probe_state::failed)
+			throw update_exception_failed();
 
-				if (checksum.compare(manifest_iter->second.hash_sum) == 0) {
-					manifest_iter->second.skip_update = true;
-					continue;
-				}
-			}
+		local_file.hash_sum = probe_hash.digest;
+		local_file.file_id = probe_hash.file_id;
+		local_file.kind = kind;
+	}
 
-			check_file_updatable(entry, false, blockers);
-		}
+	if (!manifest_entry->compared_to_local) {
+		manifest_entry->compared_to_local = true;
+
+		if (local_file.hash_sum == manifest_entry->hash_sum)
+			manifest_entry->skip_update = true;
+	}
+
+	if (manifest_entry->skip_update)
+		return;
+
+	/* Changed file has to be written, nobody may have it open */
+	switch (probe_file_for_replace(entry)) {
+	case file_probe_state::locked: {
+		std::lock_guard<std::mutex> lock(blocked_files_mutex);
+		blocked_files.push_back(static_cast<size_t>(&local_file - local_manifest.data()));
+		return;
+	}
+	case file_probe_state::read_only:
+	case file_probe_state::failed:
+		throw update_exception_failed();
+	default:
+		return;
 	}
 }
 
-void update_client::checkup_manifest(blockers_map_t &blockers)
+bool update_client::cached_local_file_checksum(local_manifest_entry_t &file, hash_kind kind)
 {
-	int max_threads = std::thread::hardware_concurrency();
+	if (params->verify_files || !hash_cache.lookup(file, kind))
+		return false;
 
-	/* Generate the manifest for the current application directory */
-	fs::recursive_directory_iterator app_dir_iter(params->app_dir);
-	fs::recursive_directory_iterator end_iter{};
+	hash_cache_hits++;
+	return true;
+}
 
-	for (; app_dir_iter != end_iter; ++app_dir_iter) {
-		fs::path entry = app_dir_iter->path();
-		std::error_code ec;
+task_pool *update_client::local_file_chunks_pool()
+{
+	/* Chunks of one tree hashed file are not read in parallel from a hdd */
+	return app_storage == storage_kind::hdd ? nullptr : &tasks;
+}
 
-		auto entry_status = fs::status(entry, ec);
-		if (ec)
+const digest_t &update_client::local_file_checksum(local_manifest_entry_t &file, hash_kind kind)
+{
+	if (cached_local_file_checksum(file, kind))
+		return file.hash_sum;
+
+	/* Scanned files are read once, most of them are not touched by the update */
+	file.hash_sum = calculate_files_checksum_safe(file.path, file_read_mode::uncached, &file.file_id, kind, local_file_chunks_pool());
+	file.kind = kind;
+
+	return file.hash_sum;
+}
+
+fs::path update_client::hash_cache_path() const
+{
+	fs::path cache_file = params->cache_dir;
+	cache_file /= "local-files.cache";
+	return cache_file;
+}
+
+fs::path update_client::apply_journal_path() const
+{
+	if (params->cache_dir.empty())
+		return fs::path();
+
+	fs::path journal_file = params->cache_dir;
+	journal_file /= "apply.journal";
+	return journal_file;
+}
+
+void update_client::recover_interrupted_update()
+{
+	fs::path journal_file = apply_journal_path();
+	if (journal_file.empty())
+		return;
+
+	/* A kept journal is tried again on next start */
+	if (!apply_journal::recover(journal_file))
+		log_warn("Interrupted update is not recovered completely");
+}
+
+void update_client::save_hash_cache()
+{
+	if (params->cache_dir.empty())
+		return;
+
+	std::vector<const local_manifest_entry_t *> files;
+	local_manifest_t updated_files;
+
+	/* Files not touched by update keep metadata from the scan */
+	for (const auto &local_file : local_manifest) {
+		const manifest_entry_t *manifest_entry = manifest.find(local_file.key);
+		if (manifest_entry != nullptr && !manifest_entry->skip_update)
 			continue;
+		if (!local_file.hash_sum.empty())
+			files.push_back(&local_file);
+	}
 
-		if (fs::is_directory(entry_status))
+	/* Updated files have checksum from manifest, only metadata is fetched */
+	updated_files.reserve(manifest.size());
+	for (const auto &entry : manifest) {
+		if (entry.skip_update || entry.remove_at_update)
 			continue;
 
-		if (std::find_if(local_manifest.begin(), local_manifest.end(),
-				 [&](std::pair<fs::path, std::string> &entry_pair) { return entry_pair.first == entry; }) != local_manifest.end())
+		std::error_code ec;
+		fs::path file_path = params->app_dir;
+		file_path /= entry.path;
+
+		fs::directory_entry dir_entry(file_path, ec);
+		if (ec)
 			continue;
 
-		local_manifest.emplace_back(entry, std::string(""));
+		auto &file = updated_files.emplace_back(file_path, std::string(entry.key));
+		file.hash_sum = entry.hash_sum;
+		file.kind = entry.kind;
+		file.size = dir_entry.file_size(ec);
+		file.mtime = dir_entry.last_write_time(ec);
+		file.file_id = get_file_id(file_path);
 	}
 
-	std::vector<std::thread *> workers;
+	for (const auto &file : updated_files) {
+		files.push_back(&file);
+	}
+
+	hash_cache.close();
+	file_hash_cache::save(hash_cache_path(), params->app_dir, files);
+}
 
-	if (max_threads > local_manifest.size())
-		max_threads = local_manifest.size();
+void update_client::checkup_manifest(blockers_map_t &blockers)
+{
+	if (local_scan_ready) {
+		/* Pipelined mode scans once, files with no local copy are downloading already and must stay that way */
+		if (local_scan_error)
+			std::rethrow_exception(local_scan_error);
+	} else {
+		/* Generate the manifest for the current application directory */
+		scan_local_files(tasks, params->app_dir, local_manifest);
+		tasks.log_utilisation("scan");
+	}
 
-	size_t from = 0;
-	size_t to = 0;
-	for (int i = 0; i < max_threads; i++) {
-		if (i + 1 != max_threads)
-			to = local_manifest.size() * (i + 1) / max_threads;
-		else
-			to = local_manifest.size();
-		workers.push_back(new std::thread(&update_client::checkup_files, this, std::ref(blockers), from, to));
-		from = to;
+	/* Biggest files first so a huge file does not start last and hold up the whole check */
+	std::vector<local_manifest_entry_t *> files;
+	files.reserve(local_manifest.size());
+	for (auto &local_file : local_manifest) {
+		files.push_back(&local_file);
 	}
+	std::sort(files.begin(), files.end(), [](const local_manifest_entry_t *a, const local_manifest_entry_t *b) { return a->size > b->size; });
 
-	for (auto worker : workers) {
-		if (worker->joinable())
-			worker->join();
+	task_group checkup_group;
+	if (app_storage == storage_kind::hdd) {
+		checkup_files_in_disk_order(blockers, files, checkup_group);
+	} else {
+		for (local_manifest_entry_t *local_file : files) {
+			tasks.submit(checkup_group, [this, &blockers, local_file]() { checkup_file(blockers, *local_file); });
+		}
 	}
+	tasks.wait(checkup_group);
+	tasks.log_utilisation("hash");
+	log_file_read_stats("checkup");
+
+	/* Download workers of pipelined mode read the manifest under the lock */
+	std::unique_lock<std::mutex> manifest_lock(manifest_mutex);
+	size_t local_only_count = local_only_files.merge_into(manifest);
+	manifest_lock.unlock();
+
+	if (local_only_count > 0)
+		log_info("Local files not in manifest %zu", local_only_count);
+
+	if (hash_cache.size() > 0)
+		log_info("Local files hash cache hits %zu of %zu files", hash_cache_hits.load(), local_manifest.size());
 
 	return;
 }
 
-std::mutex manifest_result_mutex;
+void update_client::checkup_blocked_files(blockers_map_t &blockers)
+{
+	std::vector<size_t> files;
+	{
+		std::lock_guard<std::mutex> lock(blocked_files_mutex);
+		files.swap(blocked_files);
+	}
+
+	/* Files still locked put themselves back to the list */
+	task_group checkup_group;
+	for (size_t index : files) {
+		local_manifest_entry_t *local_file = &local_manifest[index];
+		tasks.submit(checkup_group, [this, &blockers, local_file]() { checkup_file(blockers, *local_file); });
+	}
+	tasks.wait(checkup_group);
+
+	log_info("Blocked files checked again %zu, still blocked %zu", files.size(), blocked_files.size());
+}
+
+void update_client::find_blockers(blockers_map_t &blockers)
+{
+	std::vector<fs::path> paths;
+	{
+		std::lock_guard<std::mutex> lock(blocked_files_mutex);
+		paths.reserve(blocked_files.size());
+		for (size_t index : blocked_files) {
+			paths.push_back(local_manifest[index].path);
+		}
+	}
+
+	if (paths.empty())
+		return;
+
+	if (!get_blockers_list(paths, blockers)) {
+		//if fail to get blocking process info we go old way
+		throw update_exception_blocked();
+	}
+}
+
+void update_client::wait_for_blocker_processes(const blockers_map_t &blockers)
+{
+	for (auto it = blockers.list.begin(); it != blockers.list.end(); it++) {
+		DWORD process_id = (*it).second.pid;
+		if (process_id == 0)
+			continue;
+
+		HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, process_id);
+		if (!hProcess)
+			continue;
+
+		update_client::pid *blocker_ctx = new update_client::pid(io_ctx, hProcess);
+		blocker_ctx->id = process_id;
+		blocker_ctx->wrapper.async_wait([this](const boost::system::error_code &ec) {
+			if (!ec)
+				process_manifest_results();
+		});
+
+		blocker_waiters.push_back(blocker_ctx);
+	}
+}
+
+void update_client::checkup_files_in_disk_order(blockers_map_t &blockers, std::vector<local_manifest_entry_t *> &files, task_group &checkup_group)
+{
+	struct file_read_t {
+		local_manifest_entry_t *file;
+		disk_position_t position;
+		bool needs_read;
+	};
+
+	/* Files already hashed or found in the hash cache need no reads and can go in parallel,
+	 * probing the cache and the disk position only touches file metadata. */
+	std::vector<file_read_t> candidates;
+	for (local_manifest_entry_t *local_file : files) {
+		candidates.push_back({local_file, disk_position_t(), local_file->hash_sum.empty()});
+	}
+
+	task_group probe_group;
+	for (file_read_t &candidate : candidates) {
+		if (!candidate.needs_read)
+			continue;
+
+		tasks.submit(probe_group, [this, &candidate]() {
+			const manifest_entry_t *manifest_entry = manifest.find(candidate.file->key);
+			hash_kind kind = manifest_entry == nullptr ? hash_kind::sha256 : manifest_entry->kind;
+
+			candidate.needs_read = params->verify_files || !hash_cache.lookup(*candidate.file, kind);
+			if (candidate.needs_read)
+				candidate.position = get_disk_position(candidate.file->path);
+		});
+	}
+	tasks.wait(probe_group);
+
+	std::vector<file_read_t> to_read;
+	for (file_read_t &candidate : candidates) {
+		if (candidate.needs_read) {
+			to_read.push_back(candidate);
+		} else {
+			local_manifest_entry_t *local_file = candidate.file;
+			tasks.submit(checkup_group, [this, &blockers, local_file]() { checkup_file(blockers, *local_file); });
+		}
+	}
+
+	if (to_read.empty())
+		return;
+
+	std::sort(to_read.begin(), to_read.end(), [](const file_read_t &a, const file_read_t &b) { return a.position < b.position; });
+
+	log_info("Reading %zu local files in disk order", to_read.size());
+
+	/* Seeking between files costs more than hashing them, so one reader goes through them all */
+	tasks.submit(checkup_group, [this, &blockers, to_read = std::move(to_read)]() {
+		for (const file_read_t &file : to_read) {
+			checkup_file(blockers, *file.file);
+		}
+	});
+}
 
 void update_client::process_manifest_results()
 {
@@ -687,26 +1383,44 @@ void update_client::process_manifest_results()
 		return;
 	}
 
+	check_manifest_results();
+}
+
+void update_client::check_manifest_results()
+{
 	wait_for_blockers.cancel();
 	wait_for_blockers.expires_from_now(boost::posix_time::pos_infin);
 
-	for (auto pid_context : pids_waiters) {
-		delete pid_context;
+	/* Pre-staging goes on while pids are waited for */
+	if (!prestaging) {
+		for (auto pid_context : pids_waiters) {
+			delete pid_context;
+		}
+		pids_waiters.clear();
+	}
+
+	for (auto blocker_context : blocker_waiters) {
+		delete blocker_context;
 	}
-	pids_waiters.clear();
+	blocker_waiters.clear();
 
 	try {
 		blockers_map_t blockers;
-		checkup_manifest(blockers);
+		if (blocked_files.empty()) {
+			checkup_manifest(blockers);
+		} else {
+			checkup_blocked_files(blockers);
+		}
+		find_blockers(blockers);
 
 		if (blockers.list.size() > 0) {
 			std::wstring new_process_list_text;
 			for (auto it = blockers.list.begin(); it != blockers.list.end(); it++) {
-				//log_debug("Got blocker process info %i %ls", (*it).second.Process.dwProcessId, (*it).second.strAppName);
+				//log_debug("Got blocker process info %i %ls", (*it).second.pid, (*it).second.name.c_str());
 
-				new_process_list_text += (*it).second.strAppName;
+				new_process_list_text += (*it).second.name;
 				new_process_list_text += L" (";
-				new_process_list_text += std::to_wstring((*it).second.Process.dwProcessId);
+				new_process_list_text += std::to_wstring((*it).second.pid);
 				new_process_list_text += L")";
 				new_process_list_text += L"\r\n";
 			}
@@ -725,16 +1439,16 @@ void update_client::process_manifest_results()
 			case 1:
 				log_info("Got kill all command from ui");
 				for (auto it = blockers.list.begin(); it != blockers.list.end(); it++) {
-					if ((*it).second.Process.dwProcessId != 0) {
+					if ((*it).second.pid != 0) {
 						HANDLE explorer = NULL;
-						explorer = OpenProcess(PROCESS_TERMINATE, false, (*it).second.Process.dwProcessId);
+						explorer = OpenProcess(PROCESS_TERMINATE, false, (*it).second.pid);
 						if (explorer == NULL) {
-							log_error("Cannot open process %i to terminate it with error: %d", (*it).second.Process.dwProcessId,
+							log_error("Cannot open process %i to terminate it with error: %d", (*it).second.pid,
 								  GetLastError());
 						} else {
 							if (TerminateProcess(explorer, 1)) {
 							} else {
-								log_error("Failed to terminate process %i with error: %d", (*it).second.Process.dwProcessId,
+								log_error("Failed to terminate process %i with error: %d", (*it).second.pid,
 									  GetLastError());
 							}
 						}
@@ -743,15 +1457,23 @@ void update_client::process_manifest_results()
 				break;
 			case 2: {
 				log_info("Got cancel command from ui on blocker");
+				cancel_downloads();
 				client_events->error(boost::locale::translate("Update was canceled."), "Canceled");
 				reset_work_threads_guards();
 				return;
 			} break;
 			};
 
+			/* Exit of a blocker process starts the next check at once. Files closed by a process
+			 * which keeps running and commands from ui are picked up by the timer */
+			wait_for_blocker_processes(blockers);
+
 			wait_for_blockers.expires_from_now(boost::posix_time::seconds(1));
 
-			wait_for_blockers.async_wait(boost::bind(&update_client::process_manifest_results, this));
+			wait_for_blockers.async_wait([this](const boost::system::error_code &ec) {
+				if (!ec)
+					process_manifest_results();
+			});
 			return;
 		} else {
 			this->blocker_events->blocker_wait_complete();
@@ -760,24 +1482,28 @@ void update_client::process_manifest_results()
 		}
 
 	} catch (update_exception_blocked &) {
+		cancel_downloads();
 		client_events->error(
 			boost::locale::translate(
 				"Failed to move files.\nSome files may be blocked by other program. Please restart your PC and try to update again."),
 			"File access error");
 		return;
 	} catch (update_exception_failed &) {
+		cancel_downloads();
 		client_events->error(
 			boost::locale::translate(
 				"Failed to move files.\nSome files could not be updated. Please download Streamlabs Desktop installer from our site and run full installation."),
 			"File access error");
 		return;
 	} catch (std::exception &) {
+		cancel_downloads();
 		client_events->error(
 			boost::locale::translate(
 				"Failed to move files.\nSome files could not be updated. Please download Streamlabs Desktop installer from our site and run full installation."),
 			"File operation error");
 		return;
 	} catch (...) {
+		cancel_downloads();
 		client_events->error(
 			boost::locale::translate(
 				"Failed to move files.\nSome files could not be updated. Please download Streamlabs Desktop installer from our site and run full installation."),
@@ -788,16 +1514,119 @@ void update_client::process_manifest_results()
 	start_downloading_files();
 }
 
+void update_client::start_local_scan()
+{
+	log_info("Pipelined mode, local files are scanned while manifest downloads");
+
+	tasks.submit(local_scan_group, [this]() { scan_local_files(tasks, params->app_dir, local_manifest); });
+}
+
+void update_client::start_early_downloads()
+{
+	try {
+		tasks.wait(local_scan_group);
+		tasks.log_utilisation("scan");
+	} catch (...) {
+		/* Reported by checkup, nothing can be told about local files without the scan */
+		local_scan_error = std::current_exception();
+	}
+	local_scan_ready = true;
+
+	if (local_scan_error)
+		return;
+
+	/* Manifest has no sizes, so only files with no local copy are known to need a download before checkup */
+	std::vector<bool> has_local_file(manifest.size(), false);
+	for (const auto &local_file : local_manifest) {
+		const manifest_entry_t *manifest_entry = manifest.find(local_file.key);
+		if (manifest_entry != nullptr)
+			has_local_file[manifest.index_of(manifest_entry)] = true;
+	}
+
+	std::vector<size_t> missing;
+	for (size_t i = 0; i < manifest.size(); i++) {
+		if (!has_local_file[i] && !manifest[i].download_queued)
+			missing.push_back(i);
+	}
+
+	log_info("Files with no local copy to download during checkup %zu of %zu", missing.size(), manifest.size());
+
+	if (missing.empty())
+		return;
+
+	this->downloader_events->downloader_start(max_download_workers, missing.size());
+	queue_downloads(missing, false);
+}
+
 void update_client::start_downloading_files()
 {
-	int max_threads = 4;
+	std::vector<size_t> to_download;
+	size_t queued_before = 0;
+	bool early_downloads = false;
 
-	this->manifest_iterator = this->manifest.cbegin();
-	auto to_download = std::count_if(this->manifest.cbegin(), this->manifest.cend(),
-					 [](const auto &entry) { return !entry.second.remove_at_update && !entry.second.skip_update; });
-	log_info("Manifest cleaned and ready to download files. Files to download %d", to_download);
-	this->downloader_events->downloader_preparing();
-	this->downloader_events->downloader_start(max_threads, to_download);
+	{
+		std::lock_guard<std::mutex> manifest_lock(this->manifest_mutex);
+
+		index_local_content();
+
+		for (size_t i = 0; i < this->manifest.size(); i++) {
+			const manifest_entry_t &entry = this->manifest[i];
+			if (entry.remove_at_update || entry.skip_update || entry.download_queued)
+				continue;
+			to_download.push_back(i);
+		}
+		queued_before = this->download_queue.size() - this->download_round_start;
+		early_downloads = this->downloads_started;
+	}
+
+	log_info("Manifest cleaned and ready to download files. Files to download %zu", queued_before + to_download.size());
+	if (!early_downloads)
+		this->downloader_events->downloader_preparing();
+	this->downloader_events->downloader_start(max_download_workers, queued_before + to_download.size());
+
+	queue_downloads(to_download, true);
+}
+
+void update_client::queue_downloads(const std::vector<size_t> &indices, bool complete)
+{
+	std::vector<size_t> to_download;
+	std::vector<local_file_job_t> local_jobs;
+
+	{
+		std::lock_guard<std::mutex> manifest_lock(this->manifest_mutex);
+
+		if (this->downloads_canceled || update_download_aborted)
+			return;
+
+		/* Each content is requested once, files of content known already are made locally */
+		for (size_t index : indices) {
+			manifest_entry_t &entry = this->manifest[index];
+			entry.download_queued = true;
+
+			if (entry.hash_sum == empty_content_digest(entry.kind)) {
+				local_jobs.push_back(local_file_job(index, nullptr));
+				continue;
+			}
+
+			auto local_source = this->local_content.find(entry.hash_sum);
+			if (local_source != this->local_content.end() && this->local_manifest[local_source->second].kind == entry.kind) {
+				local_jobs.push_back(local_file_job(index, this->local_manifest[local_source->second]));
+				continue;
+			}
+
+			auto [source, added] = this->content_sources.try_emplace(entry.hash_sum, content_source_t{index});
+			if (added || this->manifest[source->second.index].kind != entry.kind) {
+				to_download.push_back(index);
+			} else if (source->second.staged) {
+				local_jobs.push_back(local_file_job(index, &this->manifest[source->second.index]));
+			} else {
+				source->second.copies.push_back(index);
+			}
+		}
+	}
+
+	std::vector<size_t> failed = make_local_files(local_jobs);
+	to_download.insert(to_download.end(), failed.begin(), failed.end());
 
 	/* To make sure we only have `max` number of
 	 * of requests at any given time, we hold the
@@ -807,36 +1636,180 @@ void update_client::start_downloading_files()
 	 * where n is the request that finished too fast. */
 	std::unique_lock<std::mutex> manifest_lock(this->manifest_mutex);
 
-	for (int i = 0; this->manifest_iterator != this->manifest.end() && i < max_threads; ++this->manifest_iterator) {
-		if ((*this->manifest_iterator).second.remove_at_update || (*this->manifest_iterator).second.skip_update)
-			continue;
+	if (this->downloads_canceled || update_download_aborted)
+		return;
 
-		++this->active_workers;
+	for (size_t index : to_download) {
+		this->download_queue.push_back(index);
+	}
+	this->download_queue_complete = complete;
+
+	if (!this->downloads_started) {
+		this->downloads_started = true;
+		for (int i = max_download_workers - 1; i >= 0; --i) {
+			this->idle_download_workers.push_back(i);
+		}
+	}
 
-		auto request_ctx = new file_request<http::dynamic_body>{this, fixup_uri((*this->manifest_iterator).first) + ".gz", i};
+	while (!this->idle_download_workers.empty() && this->download_position < this->download_queue.size()) {
+		int worker = this->idle_download_workers.back();
+		this->idle_download_workers.pop_back();
 
-		request_ctx->start_connect();
+		++this->active_workers;
+		start_download_request(this->download_queue[this->download_position++], worker);
+	}
 
-		++i;
+	if (!this->download_queue_complete)
+		return;
+
+	/* Workers left without a file are done */
+	const bool downloaded = this->download_queue.size() > this->download_round_start;
+	if (downloaded) {
+		for (int worker : this->idle_download_workers) {
+			this->downloader_events->download_worker_finished(worker);
+		}
 	}
+	this->idle_download_workers.clear();
 
 	if (this->active_workers == 0) {
+		finish_download_round();
 		manifest_lock.unlock();
+
+		if (downloaded)
+			this->downloader_events->downloader_complete(true);
 		this->start_file_update();
 	}
 }
 
-template<class ConstBuffer> static size_t handle_manifest_read_buffer(manifest_map_t &map, const ConstBuffer &buffer)
+void update_client::start_download_request(size_t manifest_index, int worker)
+{
+	/* Called with manifest_mutex held, entry can move once the lock is released */
+	const manifest_entry_t &entry = this->manifest[manifest_index];
+
+	auto request_ctx = new file_request<http::dynamic_body>{this, std::string(entry.url_target), worker};
+	request_ctx->checksum_kind = entry.kind;
+	request_ctx->manifest_index = manifest_index;
+
+	request_ctx->start_connect();
+}
+
+update_client::local_file_job_t update_client::local_file_job(size_t index, const manifest_entry_t *source)
 {
-	/* TODO: Hardcoded for SHA-256 checksums. */
-	static const regex manifest_regex("([A-Fa-f0-9]{64}) ([^\r\n]+)\r?\n");
+	const manifest_entry_t &entry = this->manifest[index];
+
+	local_file_job_t job;
+	job.index = index;
+	job.target = new_files_dir / entry.path;
+	if (source != nullptr)
+		job.source = new_files_dir / source->path;
+
+	job.verified = true;
+
+	job.staged.key = entry.key;
+	job.staged.kind = entry.kind;
+	job.staged.hash_sum = entry.hash_sum;
+	return job;
+}
+
+update_client::local_file_job_t update_client::local_file_job(size_t index, const local_manifest_entry_t &source)
+{
+	local_file_job_t job = local_file_job(index, nullptr);
+	job.source = source.path;
+	job.verified = false;
+	return job;
+}
+
+void update_client::index_local_content()
+{
+	/* Called with manifest_mutex held once checkup has read local files. Sources are copied,
+	 * so files to be removed or replaced by update serve as well as files kept */
+	local_content.clear();
+	for (size_t i = 0; i < local_manifest.size(); i++) {
+		const local_manifest_entry_t &local_file = local_manifest[i];
+		if (!local_file.hash_sum.empty() && local_file.size > 0)
+			local_content.try_emplace(local_file.hash_sum, i);
+	}
+}
+
+std::vector<size_t> update_client::make_local_files(const std::vector<local_file_job_t> &jobs)
+{
+	std::vector<size_t> made;
+	std::vector<size_t> failed;
+
+	for (const local_file_job_t &job : jobs) {
+		std::error_code ec;
+		fs::create_directories(job.target.parent_path(), ec);
+
+		if (job.source.empty()) {
+			std::ofstream empty_file(job.target, std::ios::binary | std::ios::trunc);
+			if (!empty_file)
+				ec = std::make_error_code(std::errc::io_error);
+		} else {
+			/* A copy and not a hardlink, the app may change one of these files later */
+			copy_file_offload(job.source, job.target, ec);
+		}
+
+		staged_file_t staged = job.staged;
+		if (ec || !read_staged_metadata(job.target, staged)) {
+			wlog_warn(L"Failed to make file %s locally, it will be downloaded", job.target.c_str());
+			failed.push_back(job.index);
+			continue;
+		}
+
+		/* Copy of app file is not verified, next run copies it again rather than trust it */
+		if (job.verified) {
+			staged_files.add(staged);
+			made.push_back(job.index);
+		}
+
+		local_files_made++;
+		local_bytes_made += staged.size;
+		if (!job.verified) {
+			app_files_copied++;
+			app_bytes_copied += staged.size;
+		}
+	}
+
+	if (!made.empty()) {
+		std::lock_guard<std::mutex> manifest_lock(this->manifest_mutex);
+		for (size_t index : made) {
+			this->manifest[index].download_verified = true;
+		}
+	}
+
+	return failed;
+}
+
+void update_client::finish_download_round()
+{
+	/* Called with manifest_mutex held once all workers are done, pre-stage mode may queue one more round */
+	this->downloads_started = false;
+	this->download_queue_complete = false;
+	this->download_round_start = this->download_queue.size();
+}
+
+void update_client::cancel_downloads()
+{
+	/* Workers finish requests in flight and stop, update does not start */
+	std::lock_guard<std::mutex> manifest_lock(this->manifest_mutex);
+
+	this->downloads_canceled = true;
+	this->download_queue.resize(this->download_position);
+	this->download_queue_complete = true;
+	this->idle_download_workers.clear();
+}
+
+template<class ConstBuffer> static size_t handle_manifest_read_buffer(manifest_store &map, const ConstBuffer &buffer)
+{
+	/* SHA-256 of whole file or, with mt256: prefix, root of SHA-256 tree over 1 MiB chunks */
+	static const regex manifest_regex("((?:mt256:)?[A-Fa-f0-9]{64}) ([^\r\n]+)\r?\n");
 
 	size_t accum = 0;
 
 	for (;;) {
 		const char *buf;
-		std::string checksum;
-		std::string file;
+		digest_t checksum;
+		hash_kind checksum_kind;
 		cmatch matches;
 		size_t buf_size = buffer.size() - accum;
 
@@ -867,9 +1840,8 @@ template<class ConstBuffer> static size_t handle_manifest_read_buffer(manifest_m
 			break;
 		}
 
-		file.assign(matches[2].first, matches[2].length());
-		checksum.assign(matches[1].first, matches[1].length());
-		map.emplace(std::make_pair(file, manifest_entry_t(checksum)));
+		parse_hash_sum(matches[1].first, matches[1].length(), checksum, checksum_kind);
+		map.emplace(std::string_view(matches[2].first, matches[2].length()), checksum, checksum_kind);
 
 		accum += matches.length();
 	}
@@ -885,10 +1857,28 @@ void update_client::handle_manifest_result(manifest_request<manifest_body> *requ
 
 	this->downloader_events->downloader_preparing();
 
+	resume_staged_files();
+
+	if (params->pipelined)
+		start_early_downloads();
+
+	if (params->prestage) {
+		log_info("Pre-stage mode, update is checked and downloaded while the application runs");
+		prestaging = true;
+		handle_pids();
+		process_manifest_results();
+		return;
+	}
+
+	/* Checkup starts as soon as Streamlabs Desktop process quits and makes files available for update.
+	 * Timer only covers a process which does not quit, its files are shown as blocked then */
 	wait_for_blockers.expires_from_now(boost::posix_time::seconds(3));
-	wait_for_blockers.async_wait(boost::bind(&update_client::process_manifest_results, this));
+	/* Canceled by the check itself, which may be over by the time the handler runs */
+	wait_for_blockers.async_wait([this](const boost::system::error_code &ec) {
+		if (!ec)
+			process_manifest_results();
+	});
 
-	/* let time for Streamlabs Desktop process to quit and make files available for update */
 	handle_pids();
 };
 
@@ -901,7 +1891,8 @@ void update_client::handle_manifest_result(manifest_request<manifest_body> *requ
 
 static constexpr std::ios_base::openmode file_flags = std::ios_base::out | std::ios_base::binary | std::ios_base::trunc;
 
-update_file_t::update_file_t(const fs::path &file_path) : file_path(file_path), file_stream(file_path, file_flags)
+update_file_t::update_file_t(const fs::path &file_path, hash_kind checksum_kind)
+	: file_path(file_path), file_stream(file_path, file_flags), checksum_filter(checksum_kind)
 {
 	if (this->file_stream.bad()) {
 		log_info("Failed to create file output stream\n");
@@ -917,22 +1908,70 @@ update_file_t::update_file_t(const fs::path &file_path) : file_path(file_path),
 
 void update_client::handle_file_result(file_request<http::dynamic_body> *request_ctx, update_file_t *file_ctx, int index)
 {
-	auto &filter = file_ctx->checksum_filter;
-
+	bool verified = false;
 	try {
+		/* Closing the chain flushes the file and finishes its checksum */
 		file_ctx->output_chain.reset();
+		verified = true;
+	} catch (...) {
+		log_warn("Failed to finish writing file %s", request_ctx->target.c_str());
+	}
+
+	staged_file_t staged;
+	if (verified) {
+		std::lock_guard<std::mutex> manifest_lock(this->manifest_mutex);
+		manifest_entry_t &entry = this->manifest[request_ctx->manifest_index];
+
+		verified = file_ctx->checksum_filter.digest == entry.hash_sum;
+		if (verified) {
+			entry.download_verified = true;
+			staged.key = entry.key;
+			staged.kind = entry.kind;
+			staged.hash_sum = entry.hash_sum;
+		} else {
+			log_warn("Downloaded file %s checksum mismatch, expected %s, got %s", request_ctx->target.c_str(),
+				 format_hash_sum(entry.kind, entry.hash_sum).c_str(), format_hash_sum(entry.kind, file_ctx->checksum_filter.digest).c_str());
+		}
+	}
+
+	const fs::path file_path = file_ctx->file_path;
+	delete file_ctx;
+
+	if (!verified) {
+		/* Downloaded again like after a connection error, update stops if it keeps failing */
+		handle_file_download_error(request_ctx, boost::asio::error::basic_errors::connection_aborted,
+					   std::string("Downloaded file checksum mismatch for: ") + request_ctx->target);
+		return;
+	}
 
-		std::ostringstream hex_digest;
+	/* Metadata is read once the file is closed, it does not change until the file is moved */
+	if (read_staged_metadata(file_path, staged))
+		staged_files.add(staged);
 
-		hex_digest << std::nouppercase << std::setfill('0') << std::hex;
+	std::vector<local_file_job_t> copies;
+	{
+		std::lock_guard<std::mutex> manifest_lock(this->manifest_mutex);
 
-		for (int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
-			hex_digest << std::setw(2) << static_cast<unsigned int>(filter.digest[i]);
+		auto source = this->content_sources.find(staged.hash_sum);
+		if (source != this->content_sources.end() && source->second.index == request_ctx->manifest_index) {
+			source->second.staged = true;
+			for (size_t copy : source->second.copies) {
+				copies.push_back(local_file_job(copy, &this->manifest[source->second.index]));
+			}
+			source->second.copies.clear();
 		}
-	} catch (...) {
 	}
 
-	delete file_ctx;
+	if (!copies.empty()) {
+		/* This worker downloads files which failed to copy before it takes the next one */
+		std::vector<size_t> failed = make_local_files(copies);
+
+		/* Canceled or aborted queue is cut at download position, nothing may be added past it */
+		std::lock_guard<std::mutex> manifest_lock(this->manifest_mutex);
+		if (!this->downloads_canceled && !update_download_aborted)
+			this->download_queue.insert(this->download_queue.end(), failed.begin(), failed.end());
+	}
+
 	delete request_ctx;
 
 	next_manifest_entry(index);
@@ -942,42 +1981,29 @@ void update_client::next_manifest_entry(int index)
 {
 	std::unique_lock<std::mutex> manifest_lock(this->manifest_mutex);
 
-	while (true) {
-		if (this->manifest_iterator == this->manifest.end() || update_download_aborted) {
-			--this->active_workers;
-
-			this->downloader_events->download_worker_finished(index);
-
-			if (this->active_workers == 0) {
-				this->downloader_events->downloader_complete(!update_download_aborted);
-				if (update_download_aborted) {
-					handle_network_error(download_abort_error, download_abort_message);
-				} else {
-					this->start_file_update();
-				}
-			}
-
-			return;
-		} else {
-			auto entry = *this->manifest_iterator;
+	if (this->download_position < this->download_queue.size() && !update_download_aborted) {
+		start_download_request(this->download_queue[this->download_position++], index);
+		return;
+	}
 
-			++this->manifest_iterator;
+	--this->active_workers;
 
-			if (entry.second.remove_at_update || entry.second.skip_update) {
-				continue;
-			} else {
-				/* Only hold the lock until we can get a reference to
-				* the entry. We are guaranteed that the entry and
-				* manifest are no longer modified at this point so
-				* the reference will stay valid */
-				manifest_lock.unlock();
+	if (!this->download_queue_complete && !update_download_aborted) {
+		/* Checkup is still looking for changed files */
+		this->idle_download_workers.push_back(index);
+		return;
+	}
 
-				auto request_ctx = new file_request<http::dynamic_body>{this, fixup_uri(entry.first) + ".gz", index};
+	this->downloader_events->download_worker_finished(index);
 
-				request_ctx->start_connect();
-			}
+	if (this->active_workers == 0 && !this->downloads_canceled) {
+		this->downloader_events->downloader_complete(!update_download_aborted);
+		if (update_download_aborted) {
+			handle_network_error(download_abort_error, download_abort_message);
+		} else {
+			finish_download_round();
+			this->start_file_update();
 		}
-		break;
 	}
 }
 
@@ -1029,7 +2055,7 @@ template<> void update_http_request<http::dynamic_body, true>::start_reading()
 		return;
 	}
 
-	auto file_ctx = new update_file_t(file_path);
+	auto file_ctx = new update_file_t(file_path, checksum_kind);
 
 	auto read_handler = [this, file_ctx](auto i, auto e) { this->handle_response_body(i, e, file_ctx); };
 
@@ -1059,11 +2085,13 @@ void update_http_request<http::dynamic_body, true>::handle_response_body(boost::
 	try {
 		auto &body = response_parser.get().body();
 
-		for (auto iter = asio::buffer_sequence_begin(body.data()); iter != asio::buffer_sequence_end(body.data()); ++iter) {
+		/* Iterators point into the buffer sequence, it has to outlive the loop */
+		const auto buffers = body.data();
+		for (auto iter = asio::buffer_sequence_begin(buffers); iter != asio::buffer_sequence_end(buffers); ++iter) {
 			file_ctx->output_chain.write((const char *)(*iter).data(), (*iter).size());
 		}
 
-		consumed = asio::buffer_size(body.data());
+		consumed = asio::buffer_size(buffers);
 		body.consume(consumed);
 		download_accum += consumed;
 	} catch (...) {
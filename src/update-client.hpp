@@ -27,7 +27,10 @@ struct install_callbacks {
  * downloader_start -> download_file -> download_progress
  *            ┌───────────No─more─files─────────┘
  *            ↓
- * download_worker_finished -> downloader_complete */
+ * download_worker_finished -> downloader_complete
+ *
+ * In pipelined mode downloader_start comes once more with the total
+ * number of files when local files checkup is over. */
 struct downloader_callbacks {
 	virtual void downloader_preparing() = 0;
 
@@ -15,6 +15,9 @@
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/locale.hpp>
 
+#include "tree-hash.hpp"
+#include "logger/log.h"
+
 namespace asio = boost::asio;
 using tcp = asio::ip::tcp;
 namespace beast = boost::beast;
@@ -25,6 +28,11 @@ namespace bio = boost::iostreams;
 struct update_client;
 struct update_file_t;
 
+/* From utils.hpp, which brings windows.h in and has to come after asio */
+std::string urlencode(const std::string &url);
+
+const size_t file_buffer_size = 4096;
+
 using manifest_body = http::basic_dynamic_body<beast::flat_buffer>;
 
 template<class Body, bool IncludeVersion> struct update_http_request {
@@ -37,6 +45,10 @@ template<class Body, bool IncludeVersion> struct update_http_request {
 	update_client *client_ctx;
 	std::string target;
 	std::string used_cdn_node_address;
+	/* How the manifest hashes the file being downloaded */
+	hash_kind checksum_kind{hash_kind::sha256};
+	/* Manifest entry of the file, its checksum is compared to the one computed while writing */
+	size_t manifest_index{0};
 
 	/* We used to support http and then I realized
 	 * I was spending a lot of time supporting both.
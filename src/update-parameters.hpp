@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "uri-parser.hpp"
+#include "storage-profile.hpp"
 
 #include <filesystem>
 
@@ -15,6 +16,8 @@ struct update_parameters {
 
 	fs::path temp_dir;
 	fs::path app_dir;
+	/* Persists between updater runs, unlike temp_dir */
+	fs::path cache_dir;
 	std::string exec;
 	std::string exec_no_update;
 	std::string exec_cwd;
@@ -25,6 +28,17 @@ struct update_parameters {
 	bool interactive = true;
 	bool restart_on_fail = false;
 	bool enable_removing_old_files = false;
+	bool verify_files = false;
+	/* Detected from app_dir when unknown */
+	storage_kind storage_profile = storage_kind::unknown;
+	/* Overlap local scan with manifest download and download files missing locally during checkup */
+	bool pipelined = false;
+	/* Check and download while the app still runs, pids are waited for only before files are replaced */
+	bool prestage = false;
+	/* Percent of moved files hashed again after update or revert, the rest is checked by size and file id */
+	int deep_verify_percent = 0;
+	/* Build new version next to app_dir with unchanged files hardlinked and switch directories by rename */
+	bool side_by_side = false;
 
 	~update_parameters()
 	{
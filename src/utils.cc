@@ -1,6 +1,10 @@
 #include "utils.hpp"
 
+#ifdef _WIN32
 #include <shellapi.h>
+#else
+#include <sys/stat.h>
+#endif
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -17,6 +21,7 @@ namespace fs = std::filesystem;
 
 MultiByteCommandLine::MultiByteCommandLine(bool skip_load) {}
 
+#ifdef _WIN32
 MultiByteCommandLine::MultiByteCommandLine()
 {
 	LPWSTR lpCommandLine = GetCommandLineW();
@@ -41,6 +46,7 @@ MultiByteCommandLine::MultiByteCommandLine()
 
 	LocalFree(wargv);
 }
+#endif
 
 MultiByteCommandLine::~MultiByteCommandLine()
 {
@@ -53,6 +59,7 @@ MultiByteCommandLine::~MultiByteCommandLine()
 
 std::string ConvertToUtf8(std::wstring from)
 {
+#ifdef _WIN32
 	int to_size = WideCharToMultiByte(CP_UTF8, 0, from.c_str(), -1, NULL, 0, NULL, NULL);
 
 	std::string ret;
@@ -66,10 +73,14 @@ std::string ConvertToUtf8(std::wstring from)
 	}
 	ret.resize(strlen(ret.c_str())); //important to end string at 0
 	return ret;
+#else
+	return boost::locale::conv::utf_to_utf<char>(from);
+#endif
 }
 
 std::wstring ConvertToUtf16WS(std::string from)
 {
+#ifdef _WIN32
 	int to_size = MultiByteToWideChar(CP_UTF8, 0, from.c_str(), -1, NULL, 0);
 
 	std::wstring ret;
@@ -83,8 +94,12 @@ std::wstring ConvertToUtf16WS(std::string from)
 	}
 
 	return ret;
+#else
+	return boost::locale::conv::utf_to_utf<wchar_t>(from);
+#endif
 }
 
+#ifdef _WIN32
 LPWSTR ConvertToUtf16LP(const char *from, int *from_size)
 {
 	int to_size = MultiByteToWideChar(CP_UTF8, 0, from, *from_size, NULL, 0);
@@ -202,6 +217,7 @@ BOOL StartApplication(const char *lpCommandLine, const char *lpWorkingDir)
 
 	return bSuccess;
 }
+#endif
 
 fs::path prepare_file_path(const fs::path &base, const std::string &target)
 {
@@ -295,11 +311,11 @@ std::string unfixup_uri(const std::string &source)
 	return result;
 }
 
-std::string calculate_files_checksum_safe(const fs::path &path)
+digest_t calculate_files_checksum_safe(const fs::path &path, file_read_mode mode, uint64_t *file_id, hash_kind kind, task_pool *pool)
 {
-	std::string checksum = "";
+	digest_t checksum;
 	try {
-		checksum = calculate_files_checksum(path);
+		checksum = calculate_files_checksum(path, mode, file_id, kind, pool);
 	} catch (const boost::exception &e) {
 		log_warn("Failed to calculate checksum of local file. Exception: %s", boost::diagnostic_information(e).c_str());
 	} catch (const std::exception &e) {
@@ -310,42 +326,44 @@ std::string calculate_files_checksum_safe(const fs::path &path)
 	return checksum;
 }
 
-std::string calculate_files_checksum(const fs::path &path)
+digest_t calculate_files_checksum(const fs::path &path, file_read_mode mode, uint64_t *file_id, hash_kind kind, task_pool *pool)
 {
-	std::ostringstream hex_digest;
-	unsigned char hash[SHA256_DIGEST_LENGTH] = {0};
-
-	std::ifstream file(path, std::ios::in | std::ios::binary);
-	if (file.is_open()) {
-		SHA256_CTX sha256;
-		SHA256_Init(&sha256);
-
-		unsigned char buffer[4096];
-		while (true) {
-			file.read((char *)buffer, 4096);
-			std::streamsize read_byte = file.gcount();
-			if (read_byte != 0) {
-				SHA256_Update(&sha256, buffer, read_byte);
-			}
-			if (!file.good()) {
-				break;
-			}
-		}
+	file_hash_result_t result;
 
-		SHA256_Final(hash, &sha256);
+	if (!hash_file(path, mode, result, kind, pool))
+		return digest_t();
 
-		file.close();
+	if (file_id)
+		*file_id = result.file_id;
 
-		hex_digest << std::nouppercase << std::setfill('0') << std::hex;
+	return result.digest;
+}
 
-		for (int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
-			hex_digest << std::setw(2) << static_cast<unsigned int>(hash[i]);
+uint64_t get_file_id(const fs::path &path)
+{
+	uint64_t file_id = 0;
+
+#ifdef _WIN32
+	/* No access rights requested so it does not conflict with other handles and does not trigger a content scan */
+	HANDLE hFile = CreateFile(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+				  FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (hFile != INVALID_HANDLE_VALUE) {
+		BY_HANDLE_FILE_INFORMATION info;
+		if (GetFileInformationByHandle(hFile, &info)) {
+			file_id = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
 		}
+		CloseHandle(hFile);
 	}
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) == 0)
+		file_id = static_cast<uint64_t>(info.st_ino);
+#endif
 
-	return hex_digest.str();
+	return file_id;
 }
 
+#ifdef _WIN32
 std::vector<char> get_messages_callback(std::string const &file_name, std::string const &encoding)
 {
 	static std::unordered_map<std::string, int> locales_resources(
@@ -410,3 +428,4 @@ void setup_locale()
 	std::locale real_locale(base_locale, blg::create_messages_facet<char>(info));
 	std::locale::global(real_locale);
 }
+#endif
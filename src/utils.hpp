@@ -5,6 +5,9 @@
 #include <unordered_map>
 #include <vector>
 
+#include "file-reader.hpp"
+#include "manifest-store.hpp"
+
 namespace fs = std::filesystem;
 
 /* We cannot use the default WM_CLOSE since there
@@ -42,8 +45,16 @@ std::string fixup_uri(const std::string &source);
 std::string encimpl(std::string::value_type v);
 std::string urlencode(const std::string &url);
 
-std::string calculate_files_checksum(const fs::path &path);
-std::string calculate_files_checksum_safe(const fs::path &path);
+/* Digest of file content of given kind, empty digest if file cannot be opened.
+ * File id from the same open is stored to file_id when it is given.
+ * Tree hash chunks are spread over the pool when it is given. */
+digest_t calculate_files_checksum(const fs::path &path, file_read_mode mode = file_read_mode::cached, uint64_t *file_id = nullptr,
+				     hash_kind kind = hash_kind::sha256, task_pool *pool = nullptr);
+digest_t calculate_files_checksum_safe(const fs::path &path, file_read_mode mode = file_read_mode::cached, uint64_t *file_id = nullptr,
+					  hash_kind kind = hash_kind::sha256, task_pool *pool = nullptr);
+
+// return 0 if file id is not available
+uint64_t get_file_id(const fs::path &path);
 
 void setup_locale();
 
@@ -69,15 +80,19 @@ protected:
 	LPSTR *m_argv{nullptr};
 };
 
-struct manifest_entry_t {
-	std::string hash_sum;
-	bool compared_to_local;
+struct local_manifest_entry_t {
+	fs::path path;
+	/* Manifest key of the file, relative to app_dir in preferred separators */
+	std::string key;
+	digest_t hash_sum;
+	hash_kind kind = hash_kind::sha256;
 
-	bool remove_at_update;
-	bool skip_update;
+	/* Metadata cached from the directory scan, used by the hash cache */
+	uintmax_t size{0};
+	fs::file_time_type mtime{};
+	uint64_t file_id{0};
 
-	manifest_entry_t(std::string &file_hash_sum) : hash_sum(file_hash_sum), compared_to_local(false), remove_at_update(false), skip_update(false) {}
+	local_manifest_entry_t(fs::path file_path, std::string file_key) : path(std::move(file_path)), key(std::move(file_key)) {}
 };
 
-using manifest_map_t = std::unordered_map<std::string, manifest_entry_t>;
-using local_manifest_t = std::vector<std::pair<fs::path, std::string>>;
\ No newline at end of file
+using local_manifest_t = std::vector<local_manifest_entry_t>;
\ No newline at end of file
@@ -0,0 +1,93 @@
+/* Blockers of locked files are found with one pass over /proc for all of them,
+ * a file held open by another process is reported with its pid.
+ *
+ *   blockers-test [files to look up]
+ *
+ * Prints time of the lookup for that many paths, a few of them held open. */
+
+#include "update-blockers.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static bool expect(bool condition, const char *what)
+{
+	if (!condition)
+		printf("FAIL %s\n", what);
+	return condition;
+}
+
+int main(int argc, char **argv)
+{
+	const size_t file_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 5000;
+	const size_t held_count = 10;
+
+	const fs::path root = fs::temp_directory_path() / "blockers-test";
+	std::error_code ec;
+	fs::remove_all(root, ec);
+	fs::create_directories(root, ec);
+
+	std::vector<fs::path> files;
+	for (size_t i = 0; i < file_count; i++) {
+		files.push_back(root / ("file" + std::to_string(i) + ".txt"));
+		std::ofstream(files.back()) << i;
+	}
+
+	int ready[2];
+	int release[2];
+	if (pipe(ready) != 0 || pipe(release) != 0)
+		return 1;
+
+	/* Child holds every n-th file open like an app which still runs */
+	pid_t child = fork();
+	if (child == 0) {
+		for (size_t i = 0; i < held_count && i < file_count; i++) {
+			if (open(files[i * (file_count / held_count)].c_str(), O_RDONLY) < 0)
+				_exit(2);
+		}
+		char byte = 1;
+		if (write(ready[1], &byte, 1) != 1 || read(release[0], &byte, 1) != 1)
+			_exit(2);
+		_exit(0);
+	}
+
+	bool ok = true;
+	char byte = 0;
+	ok &= expect(read(ready[0], &byte, 1) == 1, "child opened files");
+
+	std::vector<fs::path> held = {files[0]};
+	blockers_map_t blockers;
+	ok &= expect(get_blockers_list(held, blockers), "lookup succeeds");
+	auto found = blockers.list.find(static_cast<uint32_t>(child));
+	ok &= expect(found != blockers.list.end() && !found->second.name.empty(), "pid of child holding the file is reported with name");
+	ok &= expect(blockers.list.find(0) == blockers.list.end(), "no unknown blocker when owner is found");
+
+	blockers_map_t not_held_blockers;
+	std::vector<fs::path> not_held = {files[1]};
+	ok &= expect(get_blockers_list(not_held, not_held_blockers) && not_held_blockers.list.find(static_cast<uint32_t>(child)) == not_held_blockers.list.end(),
+		     "child is not reported for a file it does not hold");
+
+	/* All paths in one lookup, cost is one pass over open files of all processes plus the index */
+	blockers_map_t all_blockers;
+	auto start = std::chrono::steady_clock::now();
+	ok &= expect(get_blockers_list(files, all_blockers), "lookup of all files succeeds");
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	ok &= expect(all_blockers.list.count(static_cast<uint32_t>(child)) == 1, "child is reported once for all files it holds");
+	printf("blockers of %zu paths, %zu held open, found in %.1f ms\n", files.size(), held_count, ms);
+
+	if (write(release[1], &byte, 1) != 1)
+		return 1;
+	int status = 0;
+	waitpid(child, &status, 0);
+
+	fs::remove_all(root, ec);
+
+	if (ok)
+		printf("blockers checks passed\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,405 @@
+/* update_client run whole, from manifest download to files replaced in app dir, meant to run under -fsanitize=thread.
+ *
+ * A local TLS server stands in for the CDN, it serves the manifest and gzipped files the way the update server does.
+ * Windows calls of the client come from compat/windows.cc, no process can be opened there, so no pid is waited for.
+ * Scenarios are a plain and a pipelined update, and pre-stage mode with files to download and with nothing to download,
+ * which has to finish on its own. A scenario which does not finish in time fails the test. */
+
+#include "update-client.hpp"
+#include "tree-hash.hpp"
+#include "logger/log.h"
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <openssl/x509.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+namespace asio = boost::asio;
+namespace ssl = boost::asio::ssl;
+namespace http = boost::beast::http;
+using tcp = asio::ip::tcp;
+
+static bool expect(bool condition, const char *what)
+{
+	if (!condition)
+		printf("FAIL %s\n", what);
+	return condition;
+}
+
+static std::string gzip(const std::string &content)
+{
+	std::ostringstream packed;
+	{
+		boost::iostreams::filtering_ostream out;
+		out.push(boost::iostreams::gzip_compressor());
+		out.push(packed);
+		out << content;
+	}
+	return packed.str();
+}
+
+/* Files of 1 MiB and more are listed with mt256 like the update server does */
+static std::string manifest_line(const std::string &key, const std::string &content)
+{
+	digest_t digest;
+	hash_kind kind = content.size() < tree_hash_chunk_size ? hash_kind::sha256 : hash_kind::tree_sha256;
+	if (kind == hash_kind::sha256) {
+		sha256_hasher hasher;
+		hasher.update(content.data(), content.size());
+		hasher.final(digest.bytes);
+	} else {
+		tree_hasher hasher;
+		hasher.update(content.data(), content.size());
+		hasher.final(digest.bytes);
+	}
+	return format_hash_sum(kind, digest) + " " + key + "\n";
+}
+
+/* Self signed, the client does not verify the server */
+static void use_new_certificate(ssl::context &tls)
+{
+	EVP_PKEY *key = EVP_EC_gen("P-256");
+	X509 *certificate = X509_new();
+	X509_set_version(certificate, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+	X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+	X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+	X509_set_pubkey(certificate, key);
+	X509_NAME *name = X509_get_subject_name(certificate);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char *>("127.0.0.1"), -1, -1, 0);
+	X509_set_issuer_name(certificate, name);
+	X509_sign(certificate, key, EVP_sha256());
+
+	SSL_CTX_use_certificate(tls.native_handle(), certificate);
+	SSL_CTX_use_PrivateKey(tls.native_handle(), key);
+	X509_free(certificate);
+	EVP_PKEY_free(key);
+}
+
+/* Answers one request per connection, one connection at a time */
+class cdn_server {
+public:
+	explicit cdn_server(std::map<std::string, std::string> targets)
+		: m_targets(std::move(targets)), m_acceptor(m_ctx, tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0))
+	{
+		use_new_certificate(m_tls);
+		m_port = m_acceptor.local_endpoint().port();
+		m_thread = std::thread([this]() { serve(); });
+	}
+
+	~cdn_server()
+	{
+		/* Accept is blocking, a connection of our own wakes it up */
+		m_stopping = true;
+		asio::io_context wake_ctx;
+		tcp::socket wake(wake_ctx);
+		boost::system::error_code ec;
+		wake.connect(tcp::endpoint(asio::ip::make_address("127.0.0.1"), m_port), ec);
+		m_thread.join();
+	}
+
+	unsigned short port() const { return m_port; }
+	size_t file_requests() const { return m_file_requests; }
+	size_t unknown_requests() const { return m_unknown_requests; }
+
+private:
+	void serve()
+	{
+		while (!m_stopping) {
+			tcp::socket socket(m_ctx);
+			boost::system::error_code ec;
+			m_acceptor.accept(socket, ec);
+			if (!ec && !m_stopping)
+				answer(socket);
+		}
+	}
+
+	void answer(tcp::socket &socket)
+	{
+		ssl::stream<tcp::socket &> stream(socket, m_tls);
+		boost::system::error_code ec;
+		stream.handshake(ssl::stream_base::server, ec);
+		if (ec)
+			return;
+
+		boost::beast::flat_buffer buffer;
+		http::request<http::empty_body> request;
+		http::read(stream, buffer, request, ec);
+		if (ec)
+			return;
+
+		http::response<http::string_body> response;
+		response.version(request.version());
+		response.keep_alive(false);
+
+		const std::string target(request.target());
+		auto found = m_targets.find(target);
+		if (found != m_targets.end()) {
+			response.result(http::status::ok);
+			response.body() = found->second;
+			if (target.size() > 3 && target.compare(target.size() - 3, 3, ".gz") == 0)
+				m_file_requests++;
+		} else {
+			response.result(http::status::not_found);
+			m_unknown_requests++;
+		}
+		response.prepare_payload();
+
+		http::write(stream, response, ec);
+		socket.shutdown(tcp::socket::shutdown_both, ec);
+	}
+
+	std::map<std::string, std::string> m_targets;
+	asio::io_context m_ctx;
+	ssl::context m_tls{ssl::context::tls_server};
+	tcp::acceptor m_acceptor;
+	unsigned short m_port{0};
+	std::thread m_thread;
+	std::atomic_bool m_stopping{false};
+	std::atomic_size_t m_file_requests{0};
+	std::atomic_size_t m_unknown_requests{0};
+};
+
+struct test_callbacks : client_callbacks,
+			downloader_callbacks,
+			updater_callbacks,
+			pid_callbacks,
+			blocker_callbacks,
+			disk_space_callbacks,
+			install_callbacks {
+	std::atomic_bool succeeded{false};
+	std::mutex error_mutex;
+	std::string error_text;
+
+	void initialize(struct update_client *) override {}
+	void success() override { succeeded = true; }
+	void error(const std::string &error, const std::string &error_type) override
+	{
+		std::lock_guard<std::mutex> lock(error_mutex);
+		error_text = error_type + ": " + error;
+	}
+
+	void downloader_preparing() override {}
+	void downloader_start(int, size_t) override {}
+	void download_file(int, std::string &, size_t) override {}
+	void download_progress(int, size_t, size_t) override {}
+	void download_worker_finished(int) override {}
+	void downloader_complete(const bool) override {}
+
+	void updater_start() override {}
+	void update_file(std::string &) override {}
+	void update_finished(std::string &) override {}
+	void updater_complete() override {}
+
+	void pid_start() override {}
+	void pid_waiting_for(uint64_t) override {}
+	void pid_wait_finished(uint64_t) override {}
+	void pid_wait_complete() override {}
+
+	/* Nothing holds files of the app dir, a blocker shown would only wait, so it cancels */
+	void blocker_start() override {}
+	int blocker_waiting_for(const std::wstring &, bool) override { return 2; }
+	void blocker_wait_complete() override {}
+
+	/* Client asks for more free space than a build machine may have, update goes on */
+	void disk_space_check_start() override {}
+	int disk_space_waiting_for(const std::wstring &, size_t, const std::wstring &, size_t, bool) override { return 1; }
+	void disk_space_wait_complete() override {}
+
+	void installer_download_start(const std::string &) override {}
+	void installer_download_progress(const double) override {}
+	void installer_run_file(const std::string &, const std::string &, const std::string &) override {}
+	void installer_package_failed(const std::string &, const std::string &) override {}
+};
+
+struct scenario_t {
+	const char *name;
+	bool pipelined;
+	bool prestage;
+	/* App dir has the new version already, nothing is downloaded */
+	bool up_to_date;
+	/* Apply is posted from a check which still holds its lock, more rounds give the other io threads more chances to pick it up early */
+	int rounds;
+};
+
+static const char *const update_version = "1.0.1";
+static const size_t file_count = 300;
+
+static std::string file_key(size_t index)
+{
+	return "file" + std::to_string(index) + ".js";
+}
+
+/* Every file has content of its own, so none is copied from another one instead of downloaded */
+static std::string file_content(size_t index, bool new_version)
+{
+	std::string content = (new_version ? "new " : "old ") + file_key(index) + "\n";
+	size_t size = index == 0 ? 3 * tree_hash_chunk_size + 100 : 100 + index * 37 % 5000;
+	content.reserve(size);
+	while (content.size() < size)
+		content += static_cast<char>('a' + (content.size() * 7 + index) % 26);
+	return content;
+}
+
+static std::string read_file(const fs::path &path)
+{
+	std::ifstream file(path, std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void dump_log(const fs::path &log_path)
+{
+	printf("%s\n", read_file(log_path).c_str());
+}
+
+static bool run_scenario(const fs::path &root, const scenario_t &scenario)
+{
+	std::error_code ec;
+	fs::remove_all(root, ec);
+	const fs::path app_dir = root / "app";
+	fs::create_directories(app_dir);
+	fs::create_directories(root / "temp");
+	fs::create_directories(root / "cache");
+
+	/* Of the app dir files a third is changed, a third is the same and a third is missing, one file is only local */
+	std::string manifest;
+	std::map<std::string, std::string> targets;
+	size_t to_download = 0;
+	for (size_t i = 0; i < file_count; i++) {
+		const std::string content = file_content(i, true);
+		manifest += manifest_line(file_key(i), content);
+		targets["/slobs/" + std::string(update_version) + "/" + file_key(i) + ".gz"] = gzip(content);
+
+		if (scenario.up_to_date || i % 3 == 1) {
+			std::ofstream(app_dir / file_key(i), std::ios::binary) << content;
+		} else {
+			if (i % 3 == 0)
+				std::ofstream(app_dir / file_key(i), std::ios::binary) << file_content(i, false);
+			to_download++;
+		}
+	}
+	targets["/slobs/" + std::string(update_version) + ".sha256"] = manifest;
+	std::ofstream(app_dir / "local-only.txt", std::ios::binary) << "kept";
+
+	cdn_server server(std::move(targets));
+
+	const fs::path log_path = root / "updater.log";
+	FILE *log_file = fopen(log_path.c_str(), "w");
+	log_set_fp(log_file);
+	log_set_quiet(1);
+
+	update_parameters params;
+	params.host.authority = "127.0.0.1";
+	params.host.scheme = std::to_string(server.port());
+	params.host.path = "/slobs";
+	params.version = update_version;
+	params.app_dir = app_dir;
+	params.temp_dir = root / "temp";
+	params.cache_dir = root / "cache";
+	params.interactive = false;
+	params.pipelined = scenario.pipelined;
+	params.prestage = scenario.prestage;
+
+	test_callbacks callbacks;
+
+	/* Client threads are joined by flush, a hang would block it for good */
+	std::mutex done_mutex;
+	std::condition_variable done_changed;
+	bool done = false;
+	std::thread watchdog([&]() {
+		std::unique_lock<std::mutex> lock(done_mutex);
+		if (!done_changed.wait_for(lock, std::chrono::minutes(2), [&done]() { return done; })) {
+			printf("FAIL %s did not finish\n", scenario.name);
+			dump_log(log_path);
+			fflush(stdout);
+			_exit(1);
+		}
+	});
+
+	update_client *client = create_update_client(&params);
+	update_client_set_client_events(client, &callbacks);
+	update_client_set_downloader_events(client, &callbacks);
+	update_client_set_updater_events(client, &callbacks);
+	update_client_set_pid_events(client, &callbacks);
+	update_client_set_blocker_events(client, &callbacks);
+	update_client_set_disk_space_events(client, &callbacks);
+	update_client_set_installer_events(client, &callbacks);
+
+	update_client_start(client);
+	update_client_flush(client);
+	destroy_update_client(client);
+
+	{
+		std::lock_guard<std::mutex> lock(done_mutex);
+		done = true;
+	}
+	done_changed.notify_all();
+	watchdog.join();
+
+	log_set_fp(nullptr);
+	fclose(log_file);
+
+	bool ok = true;
+	ok &= expect(callbacks.succeeded, "update succeeds");
+	ok &= expect(callbacks.error_text.empty(), "no error is reported");
+	ok &= expect(server.unknown_requests() == 0, "only manifest and listed files are requested");
+	ok &= expect(server.file_requests() == to_download, "changed and missing files are downloaded once each");
+
+	size_t wrong = 0;
+	for (size_t i = 0; i < file_count; i++) {
+		if (read_file(app_dir / file_key(i)) != file_content(i, true))
+			wrong++;
+	}
+	ok &= expect(wrong == 0, "app dir has files of new version");
+	ok &= expect(read_file(app_dir / "local-only.txt") == "kept", "file missing in manifest is kept");
+
+	if (!ok) {
+		printf("%s: %s, %zu files requested of %zu, %zu wrong\n", scenario.name, callbacks.error_text.c_str(), server.file_requests(), to_download,
+		       wrong);
+		dump_log(log_path);
+	}
+	return ok;
+}
+
+int main()
+{
+	const fs::path root = fs::temp_directory_path() / "client-test";
+	const scenario_t scenarios[] = {
+		{"update", false, false, false, 1},
+		{"pipelined update", true, false, false, 1},
+		{"pre-staged update", false, true, false, 1},
+		{"pre-stage with nothing to download", false, true, true, 10},
+	};
+
+	bool ok = true;
+	for (const scenario_t &scenario : scenarios) {
+		bool passed = true;
+		for (int round = 0; round < scenario.rounds && passed; round++) {
+			passed = run_scenario(root, scenario);
+		}
+		printf("%s %s\n", scenario.name, passed ? "passed" : "failed");
+		ok &= passed;
+	}
+
+	std::error_code ec;
+	fs::remove_all(root, ec);
+
+	if (ok)
+		printf("update client checks passed\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+/* Rights of an updated file are left as they are, see windows.cc */
+
+#include <windows.h>
+
+struct ACL {
+	uint8_t revision;
+};
+
+#define ACL_REVISION 2
+#define SE_FILE_OBJECT 1
+#define DACL_SECURITY_INFORMATION 0x00000004L
+#define UNPROTECTED_DACL_SECURITY_INFORMATION 0x20000000L
+
+BOOL InitializeAcl(ACL *acl, DWORD length, DWORD revision);
+DWORD SetNamedSecurityInfo(LPWSTR object_name, int object_type, DWORD security_info, void *owner, void *group, ACL *dacl, ACL *sacl);
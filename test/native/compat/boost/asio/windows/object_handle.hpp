@@ -0,0 +1,22 @@
+#pragma once
+
+/* Found before the boost header of the same name, which is empty off Windows.
+ * OpenProcess of windows.cc never gives a handle, so nothing is waited on. */
+
+#include <windows.h>
+
+namespace boost {
+namespace asio {
+namespace windows {
+
+class object_handle {
+public:
+	template<class Context> object_handle(Context &, HANDLE) {}
+
+	template<class Handler> void async_wait(Handler &&) {}
+	void cancel() {}
+};
+
+}
+}
+}
@@ -0,0 +1,47 @@
+#include <aclapi.h>
+
+#include <cerrno>
+#include <chrono>
+#include <thread>
+
+HANDLE OpenProcess(DWORD, BOOL, DWORD)
+{
+	errno = ESRCH;
+	return nullptr;
+}
+
+BOOL TerminateProcess(HANDLE, UINT)
+{
+	return FALSE;
+}
+
+HANDLE GetCurrentThread()
+{
+	return nullptr;
+}
+
+BOOL SetThreadPriority(HANDLE, int)
+{
+	return TRUE;
+}
+
+DWORD GetLastError()
+{
+	return static_cast<DWORD>(errno);
+}
+
+void Sleep(DWORD milliseconds)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+BOOL InitializeAcl(ACL *acl, DWORD, DWORD revision)
+{
+	acl->revision = static_cast<uint8_t>(revision);
+	return TRUE;
+}
+
+DWORD SetNamedSecurityInfo(LPWSTR, int, DWORD, void *, void *, ACL *, ACL *)
+{
+	return ERROR_SUCCESS;
+}
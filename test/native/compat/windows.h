@@ -0,0 +1,34 @@
+#pragma once
+
+/* Types utils.hpp declares with, so portable sources including it build on Linux.
+ * client-test also links windows.cc, stand-ins for the few calls update-client.cc and file-updater.cc make:
+ * no process can be opened, so pids and blocker processes count as exited. */
+
+#include <cstdint>
+
+typedef int BOOL;
+typedef char CHAR;
+typedef char *LPSTR;
+typedef wchar_t *LPWSTR;
+typedef const wchar_t *LPCWSTR;
+typedef unsigned long DWORD;
+typedef unsigned int UINT;
+typedef void *HANDLE;
+
+#define WM_USER 0x0400
+
+#define FALSE 0
+#define TRUE 1
+#define ERROR_SUCCESS 0L
+
+#define SYNCHRONIZE 0x00100000L
+#define PROCESS_TERMINATE 0x0001
+#define PROCESS_ALL_ACCESS 0x001fffffL
+#define THREAD_MODE_BACKGROUND_BEGIN 0x00010000
+
+HANDLE OpenProcess(DWORD desired_access, BOOL inherit_handle, DWORD process_id);
+BOOL TerminateProcess(HANDLE process, UINT exit_code);
+HANDLE GetCurrentThread();
+BOOL SetThreadPriority(HANDLE thread, int priority);
+DWORD GetLastError();
+void Sleep(DWORD milliseconds);
@@ -0,0 +1,125 @@
+/* Manifest access of a pipelined checkup, meant to run under -fsanitize=thread.
+ *
+ * Checkup tasks on the pool look entries up and set compared_to_local and skip_update of the entry
+ * of their local file, files missing in manifest go to manifest_additions. Meanwhile download workers
+ * set download_queued and download_verified under the manifest mutex on entries with no local file.
+ * Additions are merged under the mutex once checkup is done. See update_client::manifest.
+ * client-test runs the client itself, this one the same access on a manifest far bigger than it serves. */
+
+#include "manifest-store.hpp"
+#include "task-pool.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* utils.cc needs Windows, url of an entry is not looked at here */
+std::string fixup_uri(const std::string &source)
+{
+	return source;
+}
+
+static std::string make_key(size_t index)
+{
+	return "resources\\app\\node_modules\\pkg" + std::to_string(index % 997) + "\\lib\\file" + std::to_string(index) + ".js";
+}
+
+static bool run_round(task_pool &pool, size_t manifest_files, size_t local_only_files)
+{
+	manifest_store manifest;
+	manifest_additions additions;
+	std::mutex manifest_mutex;
+
+	/* Empty key first, arena has no chunk yet */
+	manifest.emplace("");
+	for (size_t i = 0; i < manifest_files; i++) {
+		manifest.emplace(make_key(i));
+	}
+
+	/* Every second manifest file is local, local only files come after manifest ones */
+	std::vector<std::string> local_keys;
+	for (size_t i = 0; i < manifest_files; i += 2) {
+		local_keys.push_back(make_key(i));
+	}
+	for (size_t i = 0; i < local_only_files; i++) {
+		local_keys.push_back(make_key(manifest_files + i));
+	}
+
+	std::vector<size_t> missing;
+	for (size_t i = 1; i < manifest_files; i += 2) {
+		missing.push_back(manifest.index_of(manifest.find(make_key(i))));
+	}
+
+	std::atomic_size_t download_position{0};
+	auto download_worker = [&]() {
+		for (size_t position = download_position++; position < missing.size(); position = download_position++) {
+			/* Queued and verified in two steps like queue_downloads and handle_file_result */
+			{
+				std::lock_guard<std::mutex> lock(manifest_mutex);
+				manifest[missing[position]].download_queued = true;
+			}
+			std::lock_guard<std::mutex> lock(manifest_mutex);
+			manifest[missing[position]].download_verified = true;
+		}
+	};
+
+	std::vector<std::thread> download_workers;
+	for (int i = 0; i < 4; i++) {
+		download_workers.emplace_back(download_worker);
+	}
+
+	task_group checkup_group;
+	for (const std::string &key : local_keys) {
+		pool.submit(checkup_group, [&manifest, &additions, &key]() {
+			manifest_entry_t *entry = manifest.find(key);
+			if (entry == nullptr) {
+				additions.add(key, true, false);
+				return;
+			}
+
+			if (!entry->compared_to_local) {
+				entry->compared_to_local = true;
+				entry->skip_update = key.back() == 's';
+			}
+		});
+	}
+	pool.wait(checkup_group);
+
+	std::unique_lock<std::mutex> lock(manifest_mutex);
+	size_t merged = additions.merge_into(manifest);
+	lock.unlock();
+
+	for (auto &worker : download_workers) {
+		worker.join();
+	}
+
+	size_t compared = 0;
+	size_t downloaded = 0;
+	for (const auto &entry : manifest) {
+		compared += entry.compared_to_local;
+		downloaded += entry.download_verified;
+	}
+
+	const size_t expected_compared = (manifest_files + 1) / 2 + local_only_files;
+	if (merged != local_only_files || compared != expected_compared || downloaded != missing.size() || manifest.size() != manifest_files + 1 + local_only_files) {
+		printf("FAIL merged %zu of %zu, compared %zu of %zu, downloaded %zu of %zu\n", merged, local_only_files, compared, expected_compared, downloaded,
+		       missing.size());
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	task_pool pool(8);
+
+	for (int round = 0; round < 3; round++) {
+		if (!run_round(pool, 50000, 25000))
+			return 1;
+	}
+
+	printf("3 rounds of checkup over 75000 keys with downloads running\n");
+	return 0;
+}
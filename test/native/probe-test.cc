@@ -0,0 +1,93 @@
+/* Local files are hashed from a shared read open and only files to be replaced are opened exclusively.
+ * flock stands for share modes here, a lock taken on another open of the file plays the other process.
+ *
+ *   probe-test [files to time]
+ *
+ * Prints time per file of probing unchanged files, one open, and changed files, a second exclusive open. */
+
+#include "file-reader.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/file.h>
+#include <unistd.h>
+
+static bool expect(bool condition, const char *what)
+{
+	if (!condition)
+		printf("FAIL %s\n", what);
+	return condition;
+}
+
+int main(int argc, char **argv)
+{
+	const size_t file_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+
+	const fs::path root = fs::temp_directory_path() / "probe-test";
+	std::error_code ec;
+	fs::remove_all(root, ec);
+	fs::create_directories(root, ec);
+
+	const fs::path file = root / "app.asar";
+	std::ofstream(file) << "some file content";
+
+	bool ok = true;
+	file_hash_result_t result;
+
+	ok &= expect(probe_file(file, file_read_mode::cached, 0, result) == file_probe_state::available && result.size == 17, "free file is hashed");
+	ok &= expect(probe_file_for_replace(file) == file_probe_state::available, "free file can be replaced");
+	ok &= expect(probe_file(root / "missing", file_read_mode::cached, 0, result) == file_probe_state::missing, "missing file is told apart");
+
+	/* Another reader, like an antivirus scanner, shares read */
+	int other = open(file.c_str(), O_RDONLY);
+	ok &= expect(flock(other, LOCK_SH | LOCK_NB) == 0, "other reader takes shared lock");
+	ok &= expect(probe_file(file, file_read_mode::cached, 0, result) == file_probe_state::available, "file read by other is hashed");
+	ok &= expect(probe_file_for_replace(file) == file_probe_state::locked, "file read by other cannot be replaced");
+
+	/* Writer holds it exclusively */
+	ok &= expect(flock(other, LOCK_EX | LOCK_NB) == 0, "other takes exclusive lock");
+	ok &= expect(probe_file(file, file_read_mode::cached, 0, result) == file_probe_state::locked, "file locked by other is not hashed");
+	ok &= expect(probe_file_for_replace(file) == file_probe_state::locked, "file locked by other cannot be replaced");
+	close(other);
+
+	ok &= expect(probe_file_for_replace(file) == file_probe_state::available, "file is free again once other closes it");
+
+	/* Root ignores file modes */
+	if (geteuid() != 0) {
+		fs::permissions(file, fs::perms::owner_read | fs::perms::group_read | fs::perms::others_read, ec);
+		ok &= expect(probe_file(file, file_read_mode::cached, 0, result) == file_probe_state::available, "read only file is hashed");
+		ok &= expect(probe_file_for_replace(file) == file_probe_state::read_only, "read only file is told apart");
+	}
+
+	/* Unchanged files need the shared open only, changed ones the exclusive open as well */
+	std::vector<fs::path> files;
+	for (size_t i = 0; i < file_count; i++) {
+		files.push_back(root / ("file" + std::to_string(i) + ".js"));
+		std::ofstream(files.back()) << std::string(4096 + i % 4096, 'x');
+	}
+
+	auto time_probes = [&](bool changed) {
+		auto start = std::chrono::steady_clock::now();
+		for (const fs::path &path : files) {
+			bool available = probe_file(path, file_read_mode::cached, 0, result) == file_probe_state::available;
+			if (changed)
+				available = available && probe_file_for_replace(path) == file_probe_state::available;
+			ok &= expect(available, "file is probed");
+		}
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / static_cast<double>(files.size());
+	};
+
+	time_probes(false);
+	double unchanged_us = time_probes(false);
+	double changed_us = time_probes(true);
+	printf("probe of %zu files: unchanged %.1f us per file, changed %.1f us per file\n", files.size(), unchanged_us, changed_us);
+
+	fs::remove_all(root, ec);
+
+	if (ok)
+		printf("probe checks passed\n");
+	return ok ? 0 : 1;
+}
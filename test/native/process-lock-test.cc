@@ -0,0 +1,54 @@
+/* Cache dir of an install is used by one updater at a time, a second process does not get its lock
+ * until the first one exits. */
+
+#include "file-ops.hpp"
+
+#include <cstdio>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static bool expect(bool condition, const char *what)
+{
+	if (!condition)
+		printf("FAIL %s\n", what);
+	return condition;
+}
+
+int main()
+{
+	const fs::path lock_file = fs::temp_directory_path() / "process-lock-test.lock";
+	std::error_code ec;
+	fs::remove(lock_file, ec);
+
+	int ready[2];
+	int release[2];
+	if (pipe(ready) != 0 || pipe(release) != 0)
+		return 1;
+
+	pid_t child = fork();
+	if (child == 0) {
+		char byte = hold_process_lock(lock_file, ec) ? 1 : 0;
+		if (write(ready[1], &byte, 1) != 1 || read(release[0], &byte, 1) != 1)
+			_exit(2);
+		_exit(0);
+	}
+
+	bool ok = true;
+	char byte = 0;
+	ok &= expect(read(ready[0], &byte, 1) == 1 && byte == 1, "first process takes the lock");
+	ok &= expect(!hold_process_lock(lock_file, ec), "second process does not get it while first one runs");
+
+	if (write(release[1], &byte, 1) != 1)
+		return 1;
+	int status = 0;
+	waitpid(child, &status, 0);
+
+	ok &= expect(hold_process_lock(lock_file, ec), "lock is free once first process exits");
+	ok &= expect(!hold_process_lock(lock_file, ec), "second open in the same process does not get it");
+
+	fs::remove(lock_file, ec);
+
+	if (ok)
+		printf("process lock checks passed\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+/* Reads one set of files for hashing in each read mode and prints GB/s, from a cold cache and from a warm one.
+ * Also prints how much of the big files stays in the cache after a read in each mode, uncached reads
+ * should not push out data the app needs. Then reads files written in shuffled order, in manifest order
+ * and in disk order as checkup does on rotational disks.
+ *
+ *   read-bench [MiB of big files] [dir to put files in]
+ *
+ * Files go to the current dir by default, it has to be on a disk: a cold read of a file on tmpfs
+ * is a read from memory. Cache is emptied between runs with POSIX_FADV_DONTNEED on each file. */
+
+#include "file-reader.hpp"
+#include "storage-profile.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <random>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+struct bench_file_t {
+	fs::path path;
+	uint64_t size;
+};
+
+static bool write_file(const fs::path &path, uint64_t size)
+{
+	std::vector<char> block(1024 * 1024);
+	for (size_t i = 0; i < block.size(); i++)
+		block[i] = static_cast<char>(i * 131 + size);
+
+	int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (file < 0)
+		return false;
+
+	bool ok = true;
+	for (uint64_t written = 0; ok && written < size;) {
+		size_t length = static_cast<size_t>(std::min<uint64_t>(block.size(), size - written));
+		ok = write(file, block.data(), length) == static_cast<ssize_t>(length);
+		written += length;
+	}
+
+	/* Pages have to be clean before they can be dropped */
+	ok = ok && fsync(file) == 0;
+	close(file);
+	return ok;
+}
+
+static void drop_cache(const std::vector<bench_file_t> &files)
+{
+	for (const auto &file : files) {
+		int fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+// part of files of at least min_size which is in the page cache
+static double cached_part(const std::vector<bench_file_t> &files, uint64_t min_size)
+{
+	const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	uint64_t pages = 0;
+	uint64_t resident = 0;
+
+	for (const auto &file : files) {
+		if (file.size < min_size)
+			continue;
+
+		int fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		void *map = mmap(nullptr, file.size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED)
+			continue;
+
+		std::vector<unsigned char> in_core((file.size + page - 1) / page);
+		if (mincore(map, file.size, in_core.data()) == 0) {
+			pages += in_core.size();
+			for (unsigned char flags : in_core)
+				resident += flags & 1;
+		}
+		munmap(map, file.size);
+	}
+	return pages > 0 ? static_cast<double>(resident) / static_cast<double>(pages) : 0.0;
+}
+
+static double read_files(const std::vector<bench_file_t> &files, file_read_mode mode, uint64_t &bytes)
+{
+	bytes = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (const auto &file : files) {
+		file_hash_result_t result;
+		if (hash_file(file.path, mode, result))
+			bytes += result.size;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return static_cast<double>(bytes) / seconds / 1e9;
+}
+
+/* Files are written in shuffled order, so their names, as manifest keys are, do not follow their place on disk */
+static void compare_read_order(const fs::path &dir)
+{
+	std::vector<bench_file_t> files;
+	for (size_t i = 0; i < 2000; i++)
+		files.push_back({dir / ("order" + std::to_string(10000 + i) + ".js"), 64 * 1024});
+
+	std::vector<bench_file_t> write_order = files;
+	std::shuffle(write_order.begin(), write_order.end(), std::mt19937(12345));
+	for (const auto &file : write_order)
+		write_file(file.path, file.size);
+
+	std::vector<std::pair<disk_position_t, bench_file_t>> positioned;
+	size_t with_extent = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (const auto &file : files) {
+		positioned.push_back({get_disk_position(file.path), file});
+		with_extent += positioned.back().first.first_extent != 0;
+	}
+	double position_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::sort(positioned.begin(), positioned.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+	std::vector<bench_file_t> disk_order;
+	for (const auto &file : positioned)
+		disk_order.push_back(file.second);
+
+	uint64_t bytes = 0;
+	drop_cache(files);
+	double manifest_speed = read_files(files, file_read_mode::cached, bytes);
+	drop_cache(files);
+	double disk_speed = read_files(disk_order, file_read_mode::cached, bytes);
+
+	printf("storage %s, %zu files written shuffled, %zu with extent position found in %.1f ms: manifest order %.2f GB/s, disk order %.2f GB/s\n",
+	       storage_kind_name(detect_storage_kind(dir)), files.size(), with_extent, position_ms, manifest_speed, disk_speed);
+}
+
+int main(int argc, char **argv)
+{
+	const uint64_t big_mib = argc > 1 ? strtoull(argv[1], nullptr, 10) : 256;
+	const fs::path dir = (argc > 2 ? fs::path(argv[2]) : fs::current_path()) / "read-bench-files";
+	const uint64_t big_size = 32ull << 20;
+
+	std::error_code ec;
+	fs::remove_all(dir, ec);
+	fs::create_directories(dir, ec);
+
+	/* Small files always go through the cache, big ones from uncached_read_threshold up are read around it */
+	std::vector<bench_file_t> files;
+	for (size_t i = 0; i < 512; i++)
+		files.push_back({dir / ("small" + std::to_string(i) + ".js"), 16 * 1024 + i * 97});
+	for (uint64_t i = 0; i < std::max<uint64_t>(1, big_mib * (1 << 20) / big_size); i++)
+		files.push_back({dir / ("big" + std::to_string(i) + ".bin"), big_size});
+
+	for (const auto &file : files) {
+		if (!write_file(file.path, file.size)) {
+			printf("FAIL cannot write %s\n", file.path.c_str());
+			return 1;
+		}
+	}
+
+	uint64_t bytes = 0;
+	for (file_read_mode mode : {file_read_mode::cached, file_read_mode::uncached}) {
+		const char *name = mode == file_read_mode::cached ? "cached" : "uncached";
+
+		drop_cache(files);
+		double cold = read_files(files, mode, bytes);
+		double left = cached_part(files, big_size);
+		double warm = read_files(files, mode, bytes);
+
+		printf("%-8s mode, %zu files, %.1f MiB: cold %.2f GB/s, then %.2f GB/s, big files left in cache %.0f%%\n", name, files.size(),
+		       static_cast<double>(bytes) / (1 << 20), cold, warm, left * 100.0);
+		fflush(stdout);
+		log_file_read_stats(name);
+	}
+
+	compare_read_order(dir);
+	log_file_read_stats("order");
+
+	fs::remove_all(dir, ec);
+	return 0;
+}
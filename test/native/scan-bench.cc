@@ -0,0 +1,108 @@
+/* Times the local files scan on a generated app dir, the first scan and a repeated one as checkup
+ * does while it waits for blockers. The scan it replaced, one walk with a status call and a search
+ * of the whole list per file, is timed too for trees small enough to finish.
+ *
+ *   scan-bench [files] [files up to which the previous scan is timed]
+ *
+ * Tree is laid out like manyfiles of the integration tests, 100 subdirs under one top level dir,
+ * plus a few more top level dirs the scan walks in parallel. */
+
+#include "local-scanner.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+/* Walk of checkup_manifest before the scanner, with the key made per file as checkup_files did */
+static size_t previous_scan(const fs::path &app_dir, std::vector<std::pair<fs::path, std::string>> &local_manifest)
+{
+	size_t added = 0;
+	fs::recursive_directory_iterator app_dir_iter(app_dir);
+	fs::recursive_directory_iterator end_iter{};
+
+	for (; app_dir_iter != end_iter; ++app_dir_iter) {
+		fs::path entry = app_dir_iter->path();
+		std::error_code ec;
+
+		auto entry_status = fs::status(entry, ec);
+		if (ec)
+			continue;
+
+		if (fs::is_directory(entry_status))
+			continue;
+
+		if (std::find_if(local_manifest.begin(), local_manifest.end(),
+				 [&](std::pair<fs::path, std::string> &entry_pair) { return entry_pair.first == entry; }) != local_manifest.end())
+			continue;
+
+		local_manifest.emplace_back(entry, std::string());
+		added++;
+	}
+
+	for (auto &file : local_manifest) {
+		fs::path key_path(fs::relative(file.first, app_dir));
+		file.second = key_path.make_preferred().u8string();
+	}
+	return added;
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+	const size_t file_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+	const size_t previous_scan_limit = argc > 2 ? strtoul(argv[2], nullptr, 10) : 20000;
+
+	const fs::path app_dir = fs::temp_directory_path() / "scan-bench";
+	std::error_code ec;
+	fs::remove_all(app_dir, ec);
+
+	for (size_t i = 0; i < file_count; i++) {
+		fs::path dir = i % 10 == 0 ? app_dir / ("resources" + std::to_string(i % 7)) : app_dir / "dir_many" / ("sub" + std::to_string(i % 100));
+		if (i < 100 || i % 10 == 0)
+			fs::create_directories(dir, ec);
+		std::ofstream(dir / ("file" + std::to_string(i) + ".txt")) << "many files content " << i << "\n";
+	}
+	std::ofstream(app_dir / "Streamlabs OBS.exe") << "exe";
+
+	task_pool pool;
+	local_manifest_t local_manifest;
+
+	auto start = std::chrono::steady_clock::now();
+	size_t added = scan_local_files(pool, app_dir, local_manifest);
+	double first_ms = elapsed_ms(start);
+
+	start = std::chrono::steady_clock::now();
+	size_t added_again = scan_local_files(pool, app_dir, local_manifest);
+	double repeated_ms = elapsed_ms(start);
+
+	bool ok = added == file_count + 1 && added_again == 0;
+	if (!ok)
+		printf("FAIL scan found %zu files, then %zu more, expected %zu and none\n", added, added_again, file_count + 1);
+
+	printf("scan of %zu files on %u threads: %.1f ms, repeated %.1f ms\n", file_count + 1, pool.size(), first_ms, repeated_ms);
+
+	if (file_count <= previous_scan_limit) {
+		std::vector<std::pair<fs::path, std::string>> previous_manifest;
+		start = std::chrono::steady_clock::now();
+		size_t previous_added = previous_scan(app_dir, previous_manifest);
+		double previous_ms = elapsed_ms(start);
+
+		start = std::chrono::steady_clock::now();
+		previous_scan(app_dir, previous_manifest);
+		double previous_repeated_ms = elapsed_ms(start);
+
+		ok &= previous_added == added;
+		printf("previous scan: %.1f ms, repeated %.1f ms\n", previous_ms, previous_repeated_ms);
+	} else {
+		printf("previous scan not timed above %zu files, it grows with the square of file count\n", previous_scan_limit);
+	}
+
+	fs::remove_all(app_dir, ec);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,304 @@
+/* Checks sha256_hasher against known answers and chunked input, and mt256 tree hashing on the pool
+ * against streamed tree hashing. Then measures throughput of the block function in use on one buffer,
+ * over a sweep of file sizes and over a mix of file sizes like an app install, whole file SHA-256
+ * and mt256 tree with chunks hashed on the pool each.
+ *
+ *   sha256-bench [MiB to hash] [least GB/s expected] [dir to take file sizes of the mix from]
+ *
+ * Built twice by CMakeLists.txt, sha256-bench-portable has the cpu specific kernels left out,
+ * so the two outputs side by side show what the selected kernel gains. */
+
+#include "sha256.hpp"
+#include "task-pool.hpp"
+#include "tree-hash.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::string to_hex(const uint8_t digest[sha256_digest_length])
+{
+	static const char digits[] = "0123456789abcdef";
+
+	std::string hex;
+	for (size_t i = 0; i < sha256_digest_length; i++) {
+		hex += digits[digest[i] >> 4];
+		hex += digits[digest[i] & 0xf];
+	}
+	return hex;
+}
+
+static std::string hash_hex(const void *data, size_t length)
+{
+	sha256_hasher hasher;
+	uint8_t digest[sha256_digest_length];
+
+	hasher.update(data, length);
+	hasher.final(digest);
+	return to_hex(digest);
+}
+
+static bool check_known_answers()
+{
+	struct known_answer_t {
+		std::string input;
+		const char *digest;
+	};
+
+	const known_answer_t answers[] = {
+		{"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+		{"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+		{"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+		{std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+	};
+
+	bool ok = true;
+	for (const auto &answer : answers) {
+		std::string digest = hash_hex(answer.input.data(), answer.input.size());
+		if (digest != answer.digest) {
+			printf("FAIL known answer for %zu bytes: got %s, expected %s\n", answer.input.size(), digest.c_str(), answer.digest);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+/* Same bytes fed in random pieces give the same digest as one update, covers buffered partial blocks */
+static bool check_chunked_input()
+{
+	std::mt19937 random(12345);
+	std::vector<uint8_t> data(3000);
+	for (auto &byte : data)
+		byte = static_cast<uint8_t>(random());
+
+	for (size_t length = 0; length <= data.size(); length++) {
+		std::string expected = hash_hex(data.data(), length);
+
+		sha256_hasher hasher;
+		uint8_t digest[sha256_digest_length];
+		size_t position = 0;
+		while (position < length) {
+			size_t piece = std::min<size_t>(random() % 200, length - position);
+			hasher.update(data.data() + position, piece);
+			position += piece;
+		}
+		hasher.final(digest);
+
+		if (to_hex(digest) != expected) {
+			printf("FAIL chunked input of %zu bytes\n", length);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* mt256 as file-reader hashes it, chunks on the pool and root over their digests */
+static void tree_hash(const uint8_t *data, size_t size, task_pool &pool, uint8_t digest[sha256_digest_length])
+{
+	const size_t chunks = tree_hasher::chunk_count(size);
+	std::vector<std::array<uint8_t, sha256_digest_length>> chunk_digests(chunks);
+
+	auto hash_chunk = [data, size, &chunk_digests](size_t index) {
+		const size_t offset = index * tree_hash_chunk_size;
+		sha256_hasher hasher;
+		hasher.update(data + offset, std::min(tree_hash_chunk_size, size - offset));
+		hasher.final(chunk_digests[index].data());
+	};
+
+	if (chunks > 1) {
+		task_group chunks_group;
+		for (size_t i = 0; i < chunks; i++) {
+			pool.submit(chunks_group, [&hash_chunk, i]() { hash_chunk(i); });
+		}
+		pool.wait(chunks_group);
+	} else {
+		hash_chunk(0);
+	}
+
+	tree_hasher tree;
+	for (const auto &chunk_digest : chunk_digests) {
+		tree.add_chunk_digest(chunk_digest.data());
+	}
+	tree.final(digest);
+}
+
+static void whole_hash(const uint8_t *data, size_t size, uint8_t digest[sha256_digest_length])
+{
+	sha256_hasher hasher;
+	hasher.update(data, size);
+	hasher.final(digest);
+}
+
+static bool check_tree_hash(task_pool &pool)
+{
+	std::vector<uint8_t> data(3 * tree_hash_chunk_size + 12345);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = static_cast<uint8_t>(i * 7);
+
+	for (size_t size : {size_t(0), size_t(100), tree_hash_chunk_size, tree_hash_chunk_size + 1, data.size()}) {
+		uint8_t streamed[sha256_digest_length];
+		tree_hasher tree;
+		tree.update(data.data(), size);
+		tree.final(streamed);
+
+		uint8_t pooled[sha256_digest_length];
+		tree_hash(data.data(), size, pool, pooled);
+		if (to_hex(streamed) != to_hex(pooled)) {
+			printf("FAIL mt256 of %zu bytes hashed on pool differs from streamed\n", size);
+			return false;
+		}
+	}
+	return true;
+}
+
+static std::vector<uint8_t> make_data(size_t size)
+{
+	std::vector<uint8_t> data(size);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = static_cast<uint8_t>(i * 131);
+	return data;
+}
+
+/* Best of three runs, first one also faults the buffer in */
+static double best_speed(uint64_t bytes, const std::function<void()> &run)
+{
+	double best = 0;
+	for (int i = 0; i < 3; i++) {
+		auto start = std::chrono::steady_clock::now();
+		run();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		double speed = static_cast<double>(bytes) / seconds / 1e9;
+		if (speed > best)
+			best = speed;
+	}
+	return best;
+}
+
+static double measure_throughput(size_t mib)
+{
+	std::vector<uint8_t> data = make_data(mib * 1024 * 1024);
+	return best_speed(data.size(), [&data]() { hash_hex(data.data(), data.size()); });
+}
+
+struct files_speed_t {
+	double whole;
+	double tree;
+};
+
+/* Every file is hashed from the start of one buffer, so this is hashing alone, reads are left out */
+static files_speed_t measure_files(const std::vector<size_t> &sizes, task_pool &pool)
+{
+	uint64_t bytes = 0;
+	size_t largest = 0;
+	for (size_t size : sizes) {
+		bytes += size;
+		largest = std::max(largest, size);
+	}
+	std::vector<uint8_t> data = make_data(largest);
+
+	uint8_t digest[sha256_digest_length];
+	files_speed_t speed;
+	speed.whole = best_speed(bytes, [&]() {
+		for (size_t size : sizes)
+			whole_hash(data.data(), size, digest);
+	});
+	speed.tree = best_speed(bytes, [&]() {
+		for (size_t size : sizes)
+			tree_hash(data.data(), size, pool, digest);
+	});
+	return speed;
+}
+
+static void measure_size_sweep(size_t mib, task_pool &pool)
+{
+	printf("size sweep, %zu MiB per size, mt256 on %u threads:\n", mib, pool.size());
+	for (size_t size : {size_t(1) << 10, size_t(16) << 10, size_t(256) << 10, size_t(4) << 20, size_t(64) << 20}) {
+		if (size > (mib << 20))
+			break;
+
+		const size_t count = (mib << 20) / size;
+		files_speed_t speed = measure_files(std::vector<size_t>(count, size), pool);
+		printf("  %6zu KiB x %-6zu sha256 %.2f GB/s, mt256 %.2f GB/s\n", size >> 10, count, speed.whole, speed.tree);
+	}
+}
+
+/* Sizes shaped like an Electron app install: many small scripts, some assets, a few big binaries and archives.
+ * Counts are scaled down to the MiB asked for, every bucket keeps at least one file */
+static std::vector<size_t> builtin_mix(size_t mib)
+{
+	struct bucket_t {
+		size_t count;
+		size_t size;
+	};
+	const bucket_t buckets[] = {
+		{12000, 1 << 10}, {9000, 6 << 10}, {5000, 24 << 10}, {2500, 96 << 10}, {800, 512 << 10}, {150, 3 << 20}, {30, 24 << 20}, {4, 120 << 20},
+	};
+
+	uint64_t total = 0;
+	for (const auto &bucket : buckets)
+		total += static_cast<uint64_t>(bucket.count) * bucket.size;
+
+	std::vector<size_t> sizes;
+	for (const auto &bucket : buckets) {
+		size_t count = std::max<size_t>(1, static_cast<size_t>(static_cast<double>(bucket.count) * (mib << 20) / static_cast<double>(total)));
+		sizes.insert(sizes.end(), count, bucket.size);
+	}
+	return sizes;
+}
+
+static std::vector<size_t> sizes_in_dir(const std::filesystem::path &dir)
+{
+	std::vector<size_t> sizes;
+	std::error_code ec;
+	for (std::filesystem::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+		if (it->is_regular_file(ec))
+			sizes.push_back(static_cast<size_t>(it->file_size(ec)));
+	}
+	return sizes;
+}
+
+static void measure_mix(const std::vector<size_t> &sizes, const char *source, task_pool &pool)
+{
+	uint64_t bytes = 0;
+	for (size_t size : sizes)
+		bytes += size;
+
+	files_speed_t speed = measure_files(sizes, pool);
+	printf("mix %s, %zu files, %.1f MiB: sha256 %.2f GB/s, mt256 %.2f GB/s\n", source, sizes.size(), static_cast<double>(bytes) / (1 << 20), speed.whole,
+	       speed.tree);
+}
+
+int main(int argc, char **argv)
+{
+	size_t mib = argc > 1 ? strtoul(argv[1], nullptr, 10) : 256;
+	double least_speed = argc > 2 ? strtod(argv[2], nullptr) : 0;
+
+	task_pool pool;
+
+	if (!check_known_answers() || !check_chunked_input() || !check_tree_hash(pool))
+		return 1;
+
+	double speed = measure_throughput(mib);
+	printf("sha256 %s: %.2f GB/s on %zu MiB\n", sha256_backend_name(), speed, mib);
+
+	measure_size_sweep(mib, pool);
+	if (argc > 3) {
+		measure_mix(sizes_in_dir(argv[3]), argv[3], pool);
+	} else {
+		measure_mix(builtin_mix(mib), "built in, shaped like an app install", pool);
+	}
+
+	if (speed < least_speed) {
+		printf("FAIL expected at least %.2f GB/s\n", least_speed);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,53 @@
+/* Staged files record is resumed only for the same version and while it is not too old. */
+
+#include "staged-files.hpp"
+
+#include <cstdio>
+
+static bool expect(bool condition, const char *what)
+{
+	if (!condition)
+		printf("FAIL %s\n", what);
+	return condition;
+}
+
+int main()
+{
+	const fs::path record_file = fs::temp_directory_path() / "staged-files-test.record";
+	const std::chrono::seconds week = std::chrono::hours(24 * 7);
+
+	staged_file_t file;
+	file.key = "resources\\app.asar";
+	file.size = 123;
+
+	std::vector<staged_file_t> files;
+	int64_t created = 0;
+	bool ok = true;
+
+	{
+		staged_files_record record;
+		ok &= expect(record.open(record_file, "1.0.0"), "new record is created");
+		record.add(file);
+	}
+	ok &= expect(staged_files_record::load(record_file, "1.0.0", week, files, created), "fresh record loads");
+	ok &= expect(files.size() == 1 && files[0].key == file.key && files[0].size == file.size, "file is read back");
+	ok &= expect(!staged_files_record::load(record_file, "1.0.1", week, files, created), "record of other version is ignored");
+
+	/* Resumed record keeps time of the first one, so files of an update aborted over and over still expire */
+	const int64_t eight_days_ago = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count() - 8 * 24 * 3600;
+	{
+		staged_files_record record;
+		ok &= expect(record.open(record_file, "1.0.0", eight_days_ago), "resumed record is created");
+		record.add(file);
+	}
+	ok &= expect(!staged_files_record::load(record_file, "1.0.0", week, files, created), "record older than max age is ignored");
+	ok &= expect(staged_files_record::load(record_file, "1.0.0", std::chrono::hours(24 * 9), files, created) && created == eight_days_ago,
+		     "created time is kept");
+
+	std::error_code ec;
+	fs::remove(record_file, ec);
+
+	if (ok)
+		printf("staged files record checks passed\n");
+	return ok ? 0 : 1;
+}
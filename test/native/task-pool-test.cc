@@ -0,0 +1,49 @@
+/* Tasks which submit subtasks and wait for them, like tree hashing of a big file from a checkup task.
+ * A waiting task may only run its own subtasks, never another file task nested inside it. */
+
+#include "task-pool.hpp"
+
+#include <atomic>
+#include <cstdio>
+
+static thread_local int file_task_depth = 0;
+
+int main()
+{
+	task_pool pool(4);
+	task_group files_group;
+
+	std::atomic_int deepest{0};
+	std::atomic_size_t chunks_done{0};
+	const size_t files = 2000;
+	const size_t chunks_per_file = 16;
+
+	for (size_t i = 0; i < files; i++) {
+		pool.submit(files_group, [&]() {
+			file_task_depth++;
+			if (file_task_depth > deepest)
+				deepest = file_task_depth;
+
+			task_group chunks_group;
+			for (size_t chunk = 0; chunk < chunks_per_file; chunk++) {
+				pool.submit(chunks_group, [&]() { chunks_done++; });
+			}
+			pool.wait(chunks_group);
+
+			file_task_depth--;
+		});
+	}
+	pool.wait(files_group);
+
+	if (chunks_done != files * chunks_per_file) {
+		printf("FAIL %zu chunks done of %zu\n", chunks_done.load(), files * chunks_per_file);
+		return 1;
+	}
+	if (deepest != 1) {
+		printf("FAIL file tasks nested %d deep in a wait\n", deepest.load());
+		return 1;
+	}
+
+	printf("%zu file tasks, %zu chunks, no nesting\n", files, chunks_done.load());
+	return 0;
+}
@@ -0,0 +1,85 @@
+/* Only names rename_to_tombstone gives to a known dir are taken from a cleanup list, also when the list
+ * was written by a run with another temp dir. remove_tree stops when asked and never follows a link out of the tree. */
+
+#include "file-ops.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+static bool expect(bool condition, const char *what)
+{
+	if (!condition)
+		printf("FAIL %s\n", what);
+	return condition;
+}
+
+int main()
+{
+	const fs::path root = fs::temp_directory_path() / "tombstone-test";
+	const fs::path staging = root / "app.staging";
+	const fs::path old_files = staging / "old-files";
+
+	std::error_code ec;
+	fs::remove_all(root, ec);
+	fs::create_directories(old_files, ec);
+
+	bool ok = true;
+
+	fs::path tombstone = rename_to_tombstone(old_files, ec);
+	ok &= expect(!tombstone.empty() && fs::exists(tombstone), "dir is renamed aside");
+	ok &= expect(is_tombstone_of(tombstone, old_files), "tombstone of the dir is known");
+	ok &= expect(is_tombstone_of(staging / "old-files/" / ".." / tombstone.filename(), old_files), "path is compared normalized");
+
+	ok &= expect(!is_tombstone_of(tombstone, staging / "new-files"), "tombstone of other dir is not taken");
+	ok &= expect(!is_tombstone_of(root / "Windows" / tombstone.filename(), old_files), "tombstone name in other parent is not taken");
+	ok &= expect(!is_tombstone_of(staging / "Windows.tombstone-1-2", old_files), "other name with marker is not taken");
+	ok &= expect(!is_tombstone_of(staging / "old-files.tombstone-1-2\\..\\..", old_files), "suffix other than time and counter is not taken");
+	ok &= expect(!is_tombstone_of(staging, old_files), "parent itself is not taken");
+
+	/* Run which wrote the list had temp dir of its own, next run has another one */
+	const fs::path runs_root = root / "slobs-updater";
+	const fs::path previous_run = runs_root / "2026291101010ab";
+	const fs::path this_run = runs_root / "2026292101010cd";
+	const fs::path list_file = root / "cleanup.list";
+	fs::create_directories(previous_run / "old-files", ec);
+	fs::create_directories(root / "Windows" / "old-files", ec);
+
+	fs::path previous_tombstone = rename_to_tombstone(previous_run / "old-files", ec);
+	fs::path foreign_tombstone = rename_to_tombstone(root / "Windows" / "old-files", ec);
+	append_cleanup_list(list_file, previous_run / "old-files", previous_tombstone);
+	append_cleanup_list(list_file, root / "Windows" / "old-files", foreign_tombstone);
+	append_cleanup_list(list_file, previous_run / "new-files", previous_tombstone);
+	std::ofstream(list_file, std::ios::binary | std::ios::app) << foreign_tombstone.u8string() << "\n";
+
+	std::vector<std::string> rejected;
+	std::vector<fs::path> listed = read_cleanup_list(list_file, {this_run / "old-files", this_run / "new-files"}, runs_root, rejected);
+	ok &= expect(listed.size() == 1 && listed[0] == previous_tombstone, "tombstone of previous run temp dir is taken");
+	ok &= expect(rejected.size() == 3, "dir out of run dirs, tombstone of other dir and old entry of unknown dir are not taken");
+
+	rejected.clear();
+	listed = read_cleanup_list(list_file, {this_run / "old-files"}, fs::path(), rejected);
+	ok &= expect(listed.empty(), "other run dir is not taken without runs root");
+
+	/* Tree with a link to a dir outside of it */
+	const fs::path outside = root / "outside";
+	fs::create_directories(outside, ec);
+	std::ofstream(outside / "keep.txt") << "keep";
+	for (int i = 0; i < 100; i++) {
+		fs::create_directories(tombstone / std::to_string(i % 7) / "sub", ec);
+		std::ofstream(tombstone / std::to_string(i % 7) / "sub" / (std::to_string(i) + ".txt")) << i;
+	}
+	fs::create_directory_symlink(outside, tombstone / "link", ec);
+
+	std::atomic_bool stop{true};
+	ok &= expect(!remove_tree(tombstone, stop, ec) && fs::exists(tombstone), "stopped deletion leaves the tree");
+
+	stop = false;
+	ok &= expect(remove_tree(tombstone, stop, ec) && !fs::exists(tombstone), "tree is deleted");
+	ok &= expect(fs::exists(outside / "keep.txt"), "linked dir outside is left alone");
+
+	fs::remove_all(root, ec);
+
+	if (ok)
+		printf("tombstone checks passed\n");
+	return ok ? 0 : 1;
+}
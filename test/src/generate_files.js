@@ -17,6 +17,35 @@ const selfblockingfile_name = "file_self_blocker";
 
 let self_blocking_process=[];
 
+// synthetic tree of small files, used to measure local scan time
+// with manyfilesChanged new version differs in all of them, used to measure backup and apply time
+function generate_many_files(testinfo, update_subdirpath, new_version = false) {
+  const content = (new_version && testinfo.manyfilesChanged) ? "many files new content " : "many files content ";
+  let file_index;
+  for (file_index = 0; file_index < testinfo.manyfiles; file_index++) {
+    let file_name = path.join("dir_many", "sub" + (file_index % 100), "file" + file_index + ".txt");
+    fse.outputFileSync(path.join(update_subdirpath, file_name), content + file_index + "\n");
+  }
+}
+
+// same content under several names in new version only, server has to send it once
+function generate_duplicate_files(testinfo, update_subdirpath) {
+  let file_index;
+  for (file_index = 0; file_index < testinfo.duplicateFiles; file_index++) {
+    let file_name = path.join("dir_dups", "copy" + file_index + ".txt");
+    fse.outputFileSync(path.join(update_subdirpath, file_name), "duplicated content\n".repeat(1000));
+  }
+}
+
+// same content under other directory in new version, updater has to copy it from old place
+function generate_renamed_files(testinfo, update_subdirpath, new_version = false) {
+  let file_index;
+  for (file_index = 0; file_index < testinfo.renamedFiles; file_index++) {
+    let file_name = path.join(new_version ? "dir_renamed" : "dir_before_rename", "file" + file_index + ".txt");
+    fse.outputFileSync(path.join(update_subdirpath, file_name), ("renamed content " + file_index + "\n").repeat(1000));
+  }
+}
+
 async function generate_file(filedir, filename, filecontentextended = "", emptyfile = false, hugefile = false) {
   return new Promise((resolve, reject) => {
     const filepath = path.join(filedir, filename)
@@ -109,6 +138,18 @@ function filewalker(dir, done) {
   });
 };
 
+// root of SHA-256 tree over 1 MiB chunks, written as mt256:<hex> in manifest
+function tree_hash(input) {
+  const chunk_size = 1024 * 1024;
+  const root = crypto.createHash('sha256');
+  let offset = 0;
+  do {
+    root.update(crypto.createHash('sha256').update(input.subarray(offset, offset + chunk_size)).digest());
+    offset += chunk_size;
+  } while (offset < input.length);
+  return "mt256:" + root.digest('hex');
+}
+
 function generate_manifest(testinfo) {
   return new Promise((resolve, reject) => {
     const filepath = path.join(testinfo.serverDir, testinfo.versionName + ".sha256")
@@ -125,12 +166,18 @@ function generate_manifest(testinfo) {
         if (filepath == foundfile) {
           continue;
         } else {
-          const hash = crypto.createHash('sha256');
           const input = fs.readFileSync(foundfile)
+          let hash_sum;
+          if (testinfo.treeHashManifest && input.length > 1024 * 1024) {
+            hash_sum = tree_hash(input);
+          } else {
+            const hash = crypto.createHash('sha256');
+            hash.update(input);
+            hash_sum = hash.digest('hex');
+          }
 
-          hash.update(input);
           var update_subdirpath = path.join(testinfo.serverDir, testinfo.versionName)
-          stream.write(`${hash.digest('hex')}` + " " + foundfile.substring(update_subdirpath.length + 1) + "\n");
+          stream.write(hash_sum + " " + foundfile.substring(update_subdirpath.length + 1) + "\n");
 
           const gzip = zlib.createGzip();
           const inp = fs.createReadStream(foundfile);
@@ -240,7 +287,7 @@ async function generate_server_dir(testinfo) {
       let file_name = "dir_bigs\\file" + file_index + ".txt";
       await generate_file(update_subdirpath, file_name, "", false, true)
     }
-  } else {
+  } else if (!testinfo.nothingToDownload) {
     let file_index;
     for (file_index = 0; file_index < 16; file_index++) {
       let file_name = "dir_some\\file" + file_index + ".txt";
@@ -248,6 +295,10 @@ async function generate_server_dir(testinfo) {
     }
   }
 
+  generate_many_files(testinfo, update_subdirpath, true);
+  generate_renamed_files(testinfo, update_subdirpath, true);
+  generate_duplicate_files(testinfo, update_subdirpath);
+
   for(i = 0; i< testinfo.selfBlockersCount; i++)
   {
     await put_file_blocking(testinfo, selfblockingfile_server, update_subdirpath, false, i);
@@ -302,6 +353,9 @@ async function generate_initial_dir(testinfo, update_subdirpath = "") {
       await generate_file(update_subdirpath, file_name, "", false, true)
     }
   }
+
+  generate_many_files(testinfo, update_subdirpath);
+  generate_renamed_files(testinfo, update_subdirpath);
   
   for(i = 0; i< testinfo.selfBlockersCount; i++)
   {
@@ -349,7 +403,7 @@ async function generate_result_dir(testinfo, update_subdirpath) {
       let file_name = "dir_bigs\\file" + file_index + ".txt";
       await generate_file(update_subdirpath, file_name, "", false, true)
     }
-  } else {
+  } else if (!testinfo.nothingToDownload) {
     let file_index;
     for (file_index = 0; file_index < 16; file_index++) {
       let file_name = "dir_some\\file" + file_index + ".txt";
@@ -357,6 +411,10 @@ async function generate_result_dir(testinfo, update_subdirpath) {
     }
   }
   
+  generate_many_files(testinfo, update_subdirpath, true);
+  generate_renamed_files(testinfo, update_subdirpath, true);
+  generate_duplicate_files(testinfo, update_subdirpath);
+
   for(i = 0; i< testinfo.selfBlockersCount; i++)
   {
     await put_file_blocking(testinfo, selfblockingfile_server, update_subdirpath, false, i);
@@ -411,6 +469,12 @@ exports.generate_test_files = async function (testinfo) {
 
 }
 
+// files server has to send in one clean update, without manifest and empty files
+exports.count_files_to_download = function (testinfo) {
+  const downloaded = ["changed content", "from empty", "created"];
+  return testinfo.files.filter(file => downloaded.includes(file.testing)).length;
+}
+
 exports.check_results = function (testinfo) {
   var dircompare = require('dir-compare');
   var format = require('util').format;
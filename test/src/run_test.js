@@ -30,9 +30,22 @@ exports.test_update = async function (testinfo) {
   if (testinfo.more_log_output)
     console.log("--- Ready to start updater.");
   try {
+    if (testinfo.resumeAfterFail) {
+      // first run fails on one file for good, files downloaded before it stay staged
+      testinfo.let_404 = true;
+      testinfo.let_block_one_file = true;
+      await updater_launcher.start_updater(testinfo)
+      testinfo.let_404 = false;
+      testinfo.let_block_one_file = false;
+      updater_server.reset_files_served();
+    }
+
     let launched = await updater_launcher.start_updater(testinfo)
     let ret = 0;
-    if (testinfo.expectedResult == "filescorrupted") { 
+    if (testinfo.resumeAfterFail && updater_server.get_files_served() > generate_files.count_files_to_download(testinfo)) {
+      ret = 1;
+      console.log("=== Test " + testinfo.number + " result: files staged by failed run downloaded again");
+    } else if (testinfo.expectedResult == "filescorrupted") { 
       console.log("=== Test " + testinfo.number + " result: after updater files corrupted as expected");
     } else if (!generate_files.check_results(testinfo)) {
       ret = 1;
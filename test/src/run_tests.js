@@ -23,6 +23,7 @@ async function run_tests() {
         //testinfo.let_block_one_file = true;
         //testinfo.let_404 = true;
         //testinfo.morebigfiles = true;
+        //testinfo.manyfiles = 100000;
         //testinfo.expectedResult = "filescorrupted"
         // testinfo.selfBlockersCount = 5;
         // testinfo.selfBlockingFile = true;
@@ -172,6 +173,92 @@ async function run_tests() {
             failed_test_names.push(testinfo.testName);
         }
 
+        testinfo = test_config.gettestinfo(" //pipelined update, new files download while waiting for pids  ");
+        testinfo.pipelined = true;
+        testinfo.pidWaiting = true;
+        testinfo.selfBlockingFile = true;
+        testinfo.selfBlockersCount = 3;
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
+        testinfo = test_config.gettestinfo(" //pre-staged update, files download before pids exit and are applied after  ");
+        testinfo.prestage = true;
+        testinfo.pidWaiting = true;
+        testinfo.selfBlockingFile = true;
+        testinfo.selfBlockersCount = 3;
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
+        testinfo = test_config.gettestinfo(" //pre-staged update with nothing to download and application already exited  ");
+        testinfo.prestage = true;
+        testinfo.nothingToDownload = true;
+        testinfo.files = testinfo.files.filter(file => !["changed content", "from empty", "created"].includes(file.testing));
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
+        testinfo = test_config.gettestinfo(" //corrupted backup reverted, all moved files hashed again  ");
+        testinfo.corruptBackuped = true;
+        testinfo.deepVerify = 100;
+        testinfo.expectedResult = "filescorrupted"
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
+        testinfo = test_config.gettestinfo(" //side by side update, unchanged files hardlinked and directory switched  ");
+        testinfo.sideBySide = true;
+        testinfo.manyfiles = 5000;
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
+        testinfo = test_config.gettestinfo(" //same content under many names downloaded once, empty files not downloaded  ");
+        testinfo.duplicateFiles = 20;
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
+        testinfo = test_config.gettestinfo(" //files moved to other directory copied from local files, not downloaded  ");
+        testinfo.renamedFiles = 20;
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
+        testinfo = test_config.gettestinfo(" //interrupted download resumed, staged files are not downloaded again  ");
+        testinfo.resumeAfterFail = true;
+        testinfo.morebigfiles = true;
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
+        testinfo = test_config.gettestinfo(" //many changed files, backup and apply run on the pool  ");
+        testinfo.manyfiles = 5000;
+        testinfo.manyfilesChanged = true;
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
+        testinfo = test_config.gettestinfo(" //revert of many changed files, check revert time in updater log  ");
+        testinfo.manyfiles = 5000;
+        testinfo.manyfilesChanged = true;
+        testinfo.corruptBackuped = true;
+        testinfo.expectedResult = "filescorrupted"
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
         testinfo = test_config.gettestinfo(" //test some exe file blocked by rinnig it   ");
         testinfo.selfBlockingFile = true;
         testinfo.selfBlockersCount = 5;
@@ -213,6 +300,29 @@ async function run_tests() {
             failed_test_names.push(testinfo.testName);
         }
 
+        testinfo = test_config.gettestinfo(" //update with big files tree hashed in manifest ");
+        testinfo.treeHashManifest = true;
+        testinfo.morebigfiles = true;
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
+        testinfo = test_config.gettestinfo(" //local scan of 100k unchanged files, check scan time in updater log ");
+        testinfo.manyfiles = 100000;
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
+        testinfo = test_config.gettestinfo(" //local scan of 100k unchanged files read in disk order as on hdd, compare hash time with previous test ");
+        testinfo.manyfiles = 100000;
+        testinfo.storageProfile = "hdd";
+        test_result = await run_test.test_update(testinfo);
+        if (test_result != 0) {
+            failed_test_names.push(testinfo.testName);
+        }
+
         testinfo = test_config.gettestinfo(" //failed to revert of failed update ");
         test_result = await run_test.test_update(testinfo);
         testinfo.corruptBackuped = true;
@@ -33,6 +33,18 @@ exports.gettestinfo = function (testname) {
     pidWaitingList: [],
 
     morebigfiles: false,
+    manyfiles: 0,
+    manyfilesChanged: false, // all many files differ in new version, so each one is backed up and replaced
+    treeHashManifest: false, // files bigger than 1 MiB get mt256: tree hash in manifest
+    storageProfile: "", // "hdd", "ssd", empty to let updater detect it
+    pipelined: false, // scan while manifest downloads, download new files during checkup
+    prestage: false, // check and download while pids run, wait for them only to apply
+    deepVerify: 0, // percent of moved files hashed again after update or revert
+    sideBySide: false, // new version built next to app dir with hardlinks, switched by rename
+    duplicateFiles: 0, // files of the same content added by new version, downloaded once
+    renamedFiles: 0, // files moved to other directory by new version, copied from local files
+    resumeAfterFail: false, // run once failing on one file, second run downloads only files not staged by first one
+    nothingToDownload: false, // new version only keeps, empties or deletes files of app dir, nothing is downloaded
 
     let_404: false,
     let_drop: false,
@@ -24,6 +24,27 @@ exports.start_updater = async function (testinfo) {
     '--force-temp'
   ];
 
+  if (testinfo.storageProfile) {
+    updaterArgs.push('--storage-profile');
+    updaterArgs.push(testinfo.storageProfile);
+  }
+
+  if (testinfo.pipelined) {
+    updaterArgs.push('--pipelined');
+  }
+
+  if (testinfo.prestage) {
+    updaterArgs.push('--prestage');
+  }
+
+  if (testinfo.deepVerify > 0) {
+    updaterArgs.push('--deep-verify', '' + testinfo.deepVerify);
+  }
+
+  if (testinfo.sideBySide) {
+    updaterArgs.push('--side-by-side');
+  }
+
   if (testinfo.pidWaiting) {
     testinfo.pidWaitingList.forEach((pid) => {
       updaterArgs.push('-p');
@@ -19,11 +19,13 @@ var files_served = 0;
 var file_to_block;
 var have_trouble = 0;
 var files_corrupted = false;
+var duplicates_served = 0;
 
 exports.start_https_update_server = function (testinfo) {
   files_served = 0;
   file_to_block = "";
   have_trouble = 0;
+  duplicates_served = 0;
 
   proxy = httpProxy.createProxyServer();
 
@@ -88,12 +90,13 @@ exports.start_https_update_server = function (testinfo) {
         } else if(update_file.testing == "changed content") {
           
         } else if(update_file.testing == "made empty") {
-          
+          file_ok_to_update = false;
         } else if(update_file.testing == "from empty") {
           
         } else if(update_file.testing == "created") {
     
         } else if(update_file.testing == "created empty") {
+          file_ok_to_update = false;
         } else if(update_file.testing == "deleted") {
           file_ok_to_update = false;
         } else if(update_file.testing == "deleted empty") {
@@ -110,6 +113,21 @@ exports.start_https_update_server = function (testinfo) {
       }
     }
 
+    //same content is made locally from first copy downloaded
+    if(requested_file.startsWith("dir_dups")) {
+      duplicates_served = duplicates_served + 1;
+      if(duplicates_served > 1) {
+        console.log("Warning: Duplicated content requested again - " + req.url);
+        testinfo.register_unnecesary_request = true;
+      }
+    }
+
+    //content of moved files is in old place in app dir
+    if(requested_file.startsWith("dir_renamed")) {
+      console.log("Warning: Moved file requested - " + req.url);
+      testinfo.register_unnecesary_request = true;
+    }
+
     if( do_block )
     {
       have_trouble = have_trouble + 1;
@@ -169,6 +187,14 @@ exports.start_https_update_server = function (testinfo) {
     console.log('Update server emulator listening at https://' + 'localhost' + ':' + '443');
 }
 
+exports.get_files_served = function () {
+  return files_served;
+}
+
+exports.reset_files_served = function () {
+  files_served = 0;
+}
+
 exports.stop_https_update_server = function () {
   proxy.close();
   proxyServer.close();